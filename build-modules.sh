@@ -0,0 +1,268 @@
+#!/bin/bash
+
+# Build the bundled kernel modules for one or more kernel releases
+#
+# Usage: build-modules.sh [-j JOBS] [--cross-compile PREFIX] [--cpu CPU]
+#                         [--patches DIR] [--out DIR] [--pack]
+#                         KERNEL_DIR[=RELEASE]...
+#
+#   KERNEL_DIR        a configured and built kernel tree, or its O= build
+#                     directory, with Module.symvers (JetPack kernel
+#                     sources after "make modules_prepare" and a full build)
+#   =RELEASE          expected release, i.e. uname -r on the target; the
+#                     build stops if the tree would produce another vermagic
+#   -j JOBS           kernel releases built at the same time (default: all)
+#   --cross-compile P toolchain prefix (default aarch64-linux-gnu- on
+#                     hosts that are not aarch64)
+#   --cpu CPU         tune the modules for CPU, e.g. cortex-a78ae for Orin;
+#                     the modules then only run on that CPU and newer ones
+#   --patches DIR     apply DIR/*.patch and DIR/<release>/*.patch to the
+#                     module sources first (kernel-tree paths, -p1), e.g.
+#                     the librealsense kernel patches
+#   --out DIR         bundle directory (default install-modules); the
+#                     modules of each release go to DIR/<release>/
+#   --pack            also write DIR.tar.gz and DIR.tar.gz.sha256
+#
+# The module sources are copied out of each kernel tree and built there
+# with "make M=", so every module matches the headers, configuration and
+# symbol CRCs of the kernel it is loaded into. Each release also gets its
+# own jetson-latency.bt, with the struct offsets of its uvcvideo.ko. Work
+# trees and build logs are kept under build/<release>/.
+
+cd "$(dirname "$0")" || exit 1
+
+JOBS=0
+CROSS_COMPILE=""
+[ "$(uname -m)" = "aarch64" ] || CROSS_COMPILE="aarch64-linux-gnu-"
+CPU=""
+PATCHES=""
+OUT_DIR="install-modules"
+PACK=0
+KERNELS=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        -j)
+            JOBS="$2"
+            [[ "$JOBS" =~ ^[0-9]+$ ]] || { echo "Error: -j needs a number"; exit 1; }
+            shift
+            ;;
+        --cross-compile)
+            CROSS_COMPILE="$2"
+            shift
+            ;;
+        --cpu)
+            CPU="$2"
+            [ -n "$CPU" ] || { echo "Error: --cpu needs a CPU name"; exit 1; }
+            shift
+            ;;
+        --patches)
+            PATCHES="$2"
+            [ -d "$PATCHES" ] || { echo "Error: --patches needs a directory"; exit 1; }
+            PATCHES=$(readlink -f "$PATCHES")
+            shift
+            ;;
+        --out)
+            OUT_DIR="$2"
+            [ -n "$OUT_DIR" ] || { echo "Error: --out needs a directory"; exit 1; }
+            shift
+            ;;
+        --pack) PACK=1 ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        -*)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+        *) KERNELS+=("$1") ;;
+    esac
+    shift
+done
+
+[ ${#KERNELS[@]} -gt 0 ] || { echo "Error: no kernel tree given (see --help)"; exit 1; }
+command -v "${CROSS_COMPILE}gcc" >/dev/null || { echo "Error: ${CROSS_COMPILE}gcc not found"; exit 1; }
+if [ -n "$CPU" ] && ! "${CROSS_COMPILE}gcc" -mcpu="$CPU" -x c -c -o /dev/null - < /dev/null 2>/dev/null; then
+    echo "Error: ${CROSS_COMPILE}gcc does not support -mcpu=$CPU"
+    exit 1
+fi
+
+# Module sources in the kernel tree as "directory:modules"; an empty
+# module list builds the directory with its own Makefile
+SOURCES=(
+    "drivers/media/usb/uvc:"
+    "drivers/iio/common/hid-sensors:"
+    "drivers/hid:hid-sensor-hub"
+    "drivers/iio/accel:hid-sensor-accel-3d"
+    "drivers/iio/gyro:hid-sensor-gyro-3d"
+    "drivers/net/can/usb:gs_usb"
+)
+# Build these as modules even where the kernel's own config does not
+CONFIGS=(CONFIG_USB_VIDEO_CLASS=m CONFIG_HID_SENSOR_IIO_COMMON=m CONFIG_HID_SENSOR_IIO_TRIGGER=m)
+# Modules that make up the bundle, as in install-jetson-modules.sh
+MODULES=(uvcvideo hid-sensor-accel-3d hid-sensor-iio-common hid-sensor-hub hid-sensor-trigger hid-sensor-gyro-3d gs_usb)
+
+BUILD_DIR="$PWD/build"
+
+# Copy every file a patch touches that is not part of the module sources
+# (shared headers mostly) into the work tree, so it can be patched there
+copy_patched_files() {
+    local patch="$1" src="$2" work="$3" path
+    for path in $(sed -n 's|^+++ [^/]*/\([^[:space:]]*\).*|\1|p' "$patch"); do
+        [ -e "$work/$path" ] || [ ! -f "$src/$path" ] || install -D -m 644 "$src/$path" "$work/$path"
+        case "$path" in
+            *.h|drivers/media/usb/uvc/*|drivers/iio/common/hid-sensors/*) ;;
+            *) [[ " ${MODULES[*]} " == *" $(basename "$path" .c) "* ]] ||
+               echo "Warning: ${patch##*/} changes $path, which is not part of the bundle" ;;
+        esac
+    done
+}
+
+# Build the modules against one kernel tree into $OUT_DIR/<release>/.
+# Runs in the background; all output goes to the release's log.
+build_release() {
+    local kdir="$1" release="$2" src work entry dir modules module patch ko urb_work
+    src="$kdir"
+    [ -e "$kdir/source" ] && src=$(readlink -f "$kdir/source")
+    work="$BUILD_DIR/$release"
+
+    # Headers patched into the work tree take precedence over the kernel's
+    # own through the LINUXINCLUDE line of each directory
+    rm -rf "$work"
+    mkdir -p "$work"
+    echo "obj-m := $(for entry in "${SOURCES[@]}"; do printf '%s/ ' "${entry%%:*}"; done)" > "$work/Kbuild"
+    for entry in "${SOURCES[@]}"; do
+        IFS=: read -r dir modules <<< "$entry"
+        mkdir -p "$work/$dir"
+        if [ -z "$modules" ]; then
+            find "$src/$dir" -maxdepth 1 -type f -exec cp -t "$work/$dir" {} + || return 1
+            echo "LINUXINCLUDE := -I$work/include \$(LINUXINCLUDE)" >> "$work/$dir/Makefile"
+        else
+            cp "$src/$dir"/*.h "$work/$dir" 2>/dev/null
+            for module in $modules; do
+                cp "$src/$dir/$module.c" "$work/$dir" || return 1
+            done
+            {
+                echo "LINUXINCLUDE := -I$work/include \$(LINUXINCLUDE)"
+                echo "obj-m := $(printf '%s.o ' $modules)"
+            } > "$work/$dir/Kbuild"
+        fi
+    done
+
+    if [ -n "$PATCHES" ]; then
+        for patch in "$PATCHES"/*.patch "$PATCHES/$release"/*.patch; do
+            [ -f "$patch" ] || continue
+            echo "Applying ${patch#"$PATCHES"/}"
+            copy_patched_files "$patch" "$src" "$work"
+            patch -d "$work" -p1 --forward --no-backup-if-mismatch < "$patch" || return 1
+        done
+    fi
+
+    # KCFLAGS only adds to the kernel's own flags, which keep the modules
+    # free of FP/SIMD registers whatever the CPU
+    make -C "$kdir" M="$work" ARCH=arm64 CROSS_COMPILE="$CROSS_COMPILE" \
+        KCFLAGS="$KCFLAGS${CPU:+ -mcpu=$CPU}" "${CONFIGS[@]}" modules || return 1
+
+    # The latency probes reach struct uvc_urb from its work item; take the
+    # offset from this tree's headers the way asm-offsets does
+    cat > "$work/drivers/media/usb/uvc/uvc-offsets.c" <<'EOC'
+#include "uvcvideo.h"
+
+void uvc_offsets(void)
+{
+	asm volatile("\n.ascii \"->UVC_URB_WORK %0\"" : : "i" (offsetof(struct uvc_urb, work)));
+}
+EOC
+    make -C "$kdir" M="$work" ARCH=arm64 CROSS_COMPILE="$CROSS_COMPILE" \
+        KCFLAGS="$KCFLAGS${CPU:+ -mcpu=$CPU}" "${CONFIGS[@]}" drivers/media/usb/uvc/uvc-offsets.s || return 1
+    urb_work=$(sed -n 's/.*->UVC_URB_WORK [$#]*\([0-9][0-9]*\).*/\1/p' \
+               "$work/drivers/media/usb/uvc/uvc-offsets.s")
+    [ -n "$urb_work" ] || { echo "Error: cannot find the offset of the work in struct uvc_urb"; return 1; }
+
+    rm -rf "$OUT_DIR/$release.new"
+    mkdir -p "$OUT_DIR/$release.new"
+    sed "s/(arg0 - [0-9]*)/(arg0 - $urb_work)/" install-modules/jetson-latency.bt \
+        > "$OUT_DIR/$release.new/jetson-latency.bt" || return 1
+    for module in "${MODULES[@]}"; do
+        ko=$(find "$work" -name "$module.ko" -print -quit)
+        [ -n "$ko" ] || { echo "Error: $module.ko was not built"; return 1; }
+        # The same vermagic check as modprobe: the release must be exact
+        if [ "$(tr '\0' '\n' < "$ko" | sed -n 's/^vermagic=\([^ ]*\).*/\1/p' | head -n 1)" != "$release" ]; then
+            echo "Error: $module.ko does not carry vermagic $release"
+            return 1
+        fi
+        "${CROSS_COMPILE}strip" --strip-debug -o "$OUT_DIR/$release.new/$module.ko" "$ko" || return 1
+    done
+    rm -rf "$OUT_DIR/$release"
+    mv -T "$OUT_DIR/$release.new" "$OUT_DIR/$release"
+}
+
+# Check every tree up front, so a wrong LOCALVERSION is caught before
+# anything is built (a tree prepared without it gives modules that say
+# "5.15.148" and that a "5.15.148-tegra" kernel refuses to load)
+declare -A RELEASE_OF
+for entry in "${KERNELS[@]}"; do
+    kdir="${entry%%=*}"
+    expected=""
+    [[ "$entry" == *=* ]] && expected="${entry#*=}"
+    [ -d "$kdir" ] || { echo "Error: $kdir not found"; exit 1; }
+    kdir=$(readlink -f "$kdir")
+    if [ ! -f "$kdir/include/config/kernel.release" ]; then
+        echo "Error: $kdir is not prepared; run make modules_prepare there first"
+        exit 1
+    fi
+    if [ ! -f "$kdir/Module.symvers" ]; then
+        echo "Error: $kdir has no Module.symvers; build the kernel there first"
+        exit 1
+    fi
+    release=$(cat "$kdir/include/config/kernel.release")
+    if [ -n "$expected" ] && [ "$release" != "$expected" ]; then
+        echo "Error: $kdir builds for $release, expected $expected"
+        [[ "$expected" == "$release"* ]] &&
+            echo "  prepare it with: make LOCALVERSION=${expected#"$release"} modules_prepare"
+        exit 1
+    fi
+    for other in "${!RELEASE_OF[@]}"; do
+        [ "${RELEASE_OF[$other]}" != "$release" ] || { echo "Error: $other and $kdir both build $release"; exit 1; }
+    done
+    RELEASE_OF[$kdir]="$release"
+done
+
+mkdir -p "$BUILD_DIR" "$OUT_DIR"
+[ "$JOBS" -gt 0 ] || JOBS=${#RELEASE_OF[@]}
+echo "Building for ${#RELEASE_OF[@]} kernel release(s), $JOBS at a time${CPU:+, tuned for $CPU}..."
+for kdir in "${!RELEASE_OF[@]}"; do
+    while [ "$(jobs -rp | wc -l)" -ge "$JOBS" ]; do
+        wait -n
+    done
+    release="${RELEASE_OF[$kdir]}"
+    rm -f "$BUILD_DIR/$release.failed"
+    { build_release "$kdir" "$release" > "$BUILD_DIR/$release.log" 2>&1 || touch "$BUILD_DIR/$release.failed"; } &
+done
+wait
+
+failed=0
+for release in $(printf '%s\n' "${RELEASE_OF[@]}" | sort); do
+    if [ ! -e "$BUILD_DIR/$release.failed" ]; then
+        echo "  $release: ok"
+    else
+        echo "  $release: FAILED, see build/$release.log"
+        tail -n 5 "$BUILD_DIR/$release.log" | sed 's/^/      /'
+        failed=1
+    fi
+done
+[ $failed -eq 0 ] || { echo "Failed to build kernel modules"; exit 1; }
+
+# A bundle outside the tree gets the installer and its files as well
+if [ "$(readlink -f "$OUT_DIR")" != "$(readlink -f install-modules)" ]; then
+    find install-modules -maxdepth 1 -type f ! -name '*.ko' -exec cp -p -t "$OUT_DIR" {} +
+fi
+
+if [ $PACK -eq 1 ]; then
+    bundle="${OUT_DIR%/}"
+    tar -czf "$bundle.tar.gz" -C "$(dirname "$bundle")" "$(basename "$bundle")" || { echo "Failed to pack $bundle"; exit 1; }
+    (cd "$(dirname "$bundle")" && sha256sum "$(basename "$bundle").tar.gz" > "$(basename "$bundle").tar.gz.sha256")
+    echo "Bundle written to $bundle.tar.gz"
+fi
+
+echo "Kernel modules built successfully"
@@ -0,0 +1,978 @@
+#!/bin/bash
+
+# Librealsense Kernel Module Installation Script
+#
+# Usage: install-jetson-modules.sh [--force] [--preflight] [--skip-preflight]
+#                                  [--bundle install-modules.tar.gz]
+#                                  [--early-boot [--param module.name=value]...]
+#                                  [--no-early-boot]
+#                                  [--boot-report] [--rollback]
+#                                  [--tune [--profile FILE]] [--verify-tuning]
+#                                  [--self-test]
+#
+#   --force           copy and reload every module even if it is already current
+#   --preflight       only check the bundle against the running kernel
+#   --skip-preflight  install without checking vermagic and symbol CRCs
+#   --bundle FILE     install straight from the compressed bundle, verified
+#                     against FILE.sha256, without extracting it first
+#   --early-boot      load the modules from the initramfs and modules-load.d
+#                     instead of waiting for udev
+#   --param M.P=V     preset module parameter P of module M (with --early-boot);
+#                     parameters preset by earlier runs are kept
+#   --no-early-boot   undo --early-boot: remove the modules from the
+#                     initramfs and modules-load.d and drop their parameters
+#   --boot-report     show when cameras, IMUs and CAN interfaces appeared
+#                     during this boot, compared with the report saved by
+#                     --early-boot
+#   --rollback        switch back to the previously installed module set
+#                     and reload it
+#   --tune            apply the performance profile (jetson-tuning.profile)
+#                     through modprobe.d, tmpfiles.d, udev and sysfs
+#   --profile FILE    use FILE instead of the bundled profile (implies --tune)
+#   --verify-tuning   report any drift of the running system from the
+#                     applied profile
+#   --self-test       after installing, stream every camera and run each
+#                     idle CAN interface in loopback; fail if fps, drops or
+#                     latency miss the profile's selftest thresholds
+#
+# Each distinct bundle is kept as a module set under
+# /lib/modules/jetson-modules/<release>/<id>; the active one is linked
+# from /lib/modules/<release>/updates/jetson-modules. The stock modules
+# under kernel/ are left untouched.
+
+FORCE=0
+PREFLIGHT=1
+PREFLIGHT_ONLY=0
+BUNDLE=""
+EARLY_BOOT=0
+NO_EARLY_BOOT=0
+BOOT_REPORT=0
+ROLLBACK=0
+TUNE=0
+TUNE_PROFILE=""
+VERIFY_TUNING=0
+SELF_TEST=0
+PARAMS=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --force) FORCE=1 ;;
+        --bundle)
+            BUNDLE="$2"
+            [ -n "$BUNDLE" ] || { echo "Error: --bundle needs a file"; exit 1; }
+            shift
+            ;;
+        --early-boot) EARLY_BOOT=1 ;;
+        --no-early-boot) NO_EARLY_BOOT=1 ;;
+        --param)
+            [[ "$2" =~ ^[A-Za-z0-9_-]+\.[A-Za-z0-9_]+=.+$ ]] || { echo "Error: --param needs module.name=value"; exit 1; }
+            PARAMS+=("$2")
+            shift
+            ;;
+        --boot-report) BOOT_REPORT=1 ;;
+        --rollback) ROLLBACK=1 ;;
+        --tune) TUNE=1 ;;
+        --profile)
+            TUNE_PROFILE="$2"
+            [ -f "$TUNE_PROFILE" ] || { echo "Error: --profile needs an existing file"; exit 1; }
+            TUNE=1
+            shift
+            ;;
+        --verify-tuning) VERIFY_TUNING=1 ;;
+        --self-test) SELF_TEST=1 ;;
+        --preflight) PREFLIGHT_ONLY=1 ;;
+        --skip-preflight) PREFLIGHT=0 ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+if [ ${#PARAMS[@]} -gt 0 ] && [ $EARLY_BOOT -eq 0 ]; then
+    echo "Error: --param is only used together with --early-boot"
+    exit 1
+fi
+if [ $NO_EARLY_BOOT -eq 1 ] && [ $EARLY_BOOT -eq 1 ]; then
+    echo "Error: --no-early-boot cannot be combined with --early-boot"
+    exit 1
+fi
+
+# Print when each camera, IMU and CAN device appeared, in seconds since
+# boot, from the activation time of its systemd .device unit
+boot_report() {
+    local dev name unit ts
+    for dev in /dev/video* /dev/iio:device* /sys/class/net/can*; do
+        [ -e "$dev" ] || continue
+        case "$dev" in
+            /sys/class/net/*)
+                name="${dev##*/}"
+                unit="sys-subsystem-net-devices-$name.device"
+                ;;
+            *)
+                name="${dev#/dev/}"
+                unit=$(systemd-escape -p --suffix=device "$dev")
+                ;;
+        esac
+        ts=$(systemctl show -p ActiveEnterTimestampMonotonic --value "$unit" 2>/dev/null)
+        [ -n "$ts" ] && [ "$ts" -gt 0 ] || continue
+        printf "%s %d.%03d\n" "$name" $((ts / 1000000)) $((ts / 1000 % 1000))
+    done
+}
+
+BOOT_REPORT_DIR="/var/lib/jetson-modules"
+
+if [ $BOOT_REPORT -eq 1 ]; then
+    current=$(boot_report)
+    [ -n "$current" ] || { echo "No camera, IMU or CAN devices with boot timing found"; exit 1; }
+    echo "Device availability (seconds since boot):"
+    if [ -f "$BOOT_REPORT_DIR/boot-report.before" ]; then
+        printf "  %-20s %10s %10s %10s\n" device before now change
+        awk 'NR == FNR { before[$1] = $2; next }
+             { if ($1 in before)
+                   printf "  %-20s %10.3f %10.3f %+10.3f\n", $1, before[$1], $2, $2 - before[$1]
+               else
+                   printf "  %-20s %10s %10.3f\n", $1, "-", $2 }' \
+            "$BOOT_REPORT_DIR/boot-report.before" - <<< "$current"
+    else
+        awk '{ printf "  %-20s %10.3f\n", $1, $2 }' <<< "$current"
+    fi
+    awk '$2 > last { last = $2 } END { printf "All devices ready %.3f s after boot\n", last }' <<< "$current"
+    exit 0
+fi
+
+# Tuning profile and the files generated from it
+TUNING_PROFILE="jetson-tuning.profile"
+TUNING_DIR="/etc/jetson-modules"
+TUNING_MODPROBE="/etc/modprobe.d/jetson-tuning.conf"
+TUNING_TMPFILES="/etc/tmpfiles.d/jetson-tuning.conf"
+TUNING_RULES="/etc/udev/rules.d/97-jetson-tuning.rules"
+
+# Print the settings of a tuning profile as "kind key value" lines
+read_profile() {
+    sed -e 's/#.*//' -e '/^[[:space:]]*$/d' "$1" | awk '{ print $1, $2, $3 }'
+}
+
+# Check whether a module is built into the running kernel
+is_builtin() {
+    grep -qE "/${1//_/[-_]}\.ko$" "/lib/modules/$(uname -r)/modules.builtin" 2>/dev/null
+}
+
+# Print the numbers of the interrupts whose name matches a pattern
+irqs_matching() {
+    awk -v pat="$1" '$1 ~ /^[0-9]+:$/ && $NF ~ pat { sub(":", "", $1); print $1 }' /proc/interrupts
+}
+
+# Print the sysfs directories of USB devices matching vendor:product
+usb_devices_matching() {
+    local vid="${1%%:*}" pid="${1#*:}" dev
+    for dev in /sys/bus/usb/devices/*; do
+        [ -f "$dev/idVendor" ] || continue
+        [ "$(cat "$dev/idVendor")" = "$vid" ] || continue
+        [ "$pid" = "*" ] || [ "$(cat "$dev/idProduct")" = "$pid" ] || continue
+        echo "$dev"
+    done
+}
+
+# Compare the running system with the applied profile, one line per
+# setting; returns non-zero if anything drifted
+verify_tuning() {
+    local profile="$TUNING_DIR/tuning.profile" drift=0 kind key value path current dev irq file
+    [ -f "$profile" ] || { echo "No tuning profile applied (run with --tune)"; return 1; }
+    for file in "$TUNING_MODPROBE" "$TUNING_TMPFILES" "$TUNING_RULES"; do
+        [ -f "$file" ] || { echo "  DRIFT  $file missing"; drift=$((drift + 1)); }
+    done
+    while read -r kind key value; do
+        case "$kind" in
+            param)
+                path="/sys/module/${key%%.*}/parameters/${key#*.}"
+                if [ ! -r "$path" ]; then
+                    echo "  DRIFT  param $key: not available (module not loaded?)"
+                    drift=$((drift + 1))
+                    continue
+                fi
+                current=$(cat "$path")
+                # bool parameters read back as Y/N
+                case "$current" in Y) current=1 ;; N) current=0 ;; esac
+                if [ "$current" = "$value" ]; then
+                    echo "  ok     param $key = $value"
+                else
+                    echo "  DRIFT  param $key: $current, profile $value"
+                    drift=$((drift + 1))
+                fi
+                ;;
+            usb-power)
+                for dev in $(usb_devices_matching "$key"); do
+                    current=$(cat "$dev/power/control" 2>/dev/null)
+                    if [ "$current" = "$value" ]; then
+                        echo "  ok     usb-power ${dev##*/} ($key) = $value"
+                    else
+                        echo "  DRIFT  usb-power ${dev##*/} ($key): $current, profile $value"
+                        drift=$((drift + 1))
+                    fi
+                done
+                ;;
+            irq-affinity)
+                for irq in $(irqs_matching "$key"); do
+                    current=$(cat "/proc/irq/$irq/smp_affinity_list" 2>/dev/null)
+                    if [ "$current" = "$value" ]; then
+                        echo "  ok     irq-affinity $irq ($key) = $value"
+                    else
+                        echo "  DRIFT  irq-affinity $irq ($key): $current, profile $value"
+                        drift=$((drift + 1))
+                    fi
+                done
+                ;;
+        esac
+    done < <(read_profile "$profile")
+    echo "Tuning: $drift drift(s) from $profile"
+    [ $drift -eq 0 ]
+}
+
+if [ $VERIFY_TUNING -eq 1 ]; then
+    verify_tuning
+    exit
+fi
+
+# Generate the persistent configuration for a profile and apply it to the
+# running system right away
+apply_tuning() {
+    local profile="$1" kind key value module param vid pid dev irq file
+    echo "Applying tuning profile..."
+    mkdir -p "$TUNING_DIR" "$(dirname "$TUNING_MODPROBE")" "$(dirname "$TUNING_TMPFILES")" "$(dirname "$TUNING_RULES")"
+    cp "$profile" "$TUNING_DIR/tuning.profile.new" && mv -f "$TUNING_DIR/tuning.profile.new" "$TUNING_DIR/tuning.profile"
+    for file in "$TUNING_MODPROBE" "$TUNING_TMPFILES" "$TUNING_RULES"; do
+        echo "# Generated by install-jetson-modules.sh from $TUNING_DIR/tuning.profile" > "$file.new"
+    done
+
+    while read -r kind key value; do
+        case "$kind" in
+            param)
+                module="${key%%.*}"
+                param="${key#*.}"
+                if is_builtin "$module"; then
+                    echo "w /sys/module/$module/parameters/$param - - - - $value" >> "$TUNING_TMPFILES.new"
+                else
+                    echo "options $module $param=$value" >> "$TUNING_MODPROBE.new"
+                fi
+                if [ -w "/sys/module/$module/parameters/$param" ]; then
+                    echo "$value" > "/sys/module/$module/parameters/$param" || echo "Warning: could not set $key"
+                fi
+                ;;
+            usb-power)
+                vid="${key%%:*}"
+                pid="${key#*:}"
+                if [ "$pid" = "*" ]; then
+                    echo "ACTION==\"add\", SUBSYSTEM==\"usb\", ENV{DEVTYPE}==\"usb_device\", ATTR{idVendor}==\"$vid\", TEST==\"power/control\", ATTR{power/control}=\"$value\""
+                else
+                    echo "ACTION==\"add\", SUBSYSTEM==\"usb\", ENV{DEVTYPE}==\"usb_device\", ATTR{idVendor}==\"$vid\", ATTR{idProduct}==\"$pid\", TEST==\"power/control\", ATTR{power/control}=\"$value\""
+                fi >> "$TUNING_RULES.new"
+                for dev in $(usb_devices_matching "$key"); do
+                    echo "$value" > "$dev/power/control" || echo "Warning: could not set power/control of ${dev##*/}"
+                done
+                ;;
+            irq-affinity)
+                # Interrupt numbers come from the device tree and do not
+                # change between boots on the same board
+                for irq in $(irqs_matching "$key"); do
+                    echo "w /proc/irq/$irq/smp_affinity_list - - - - $value" >> "$TUNING_TMPFILES.new"
+                    echo "$value" > "/proc/irq/$irq/smp_affinity_list" || echo "Warning: could not set affinity of IRQ $irq"
+                done
+                ;;
+            selftest)
+                # Thresholds for --self-test, nothing to apply
+                ;;
+            *)
+                echo "Warning: unknown tuning setting '$kind'"
+                ;;
+        esac
+    done < <(read_profile "$profile")
+
+    for file in "$TUNING_MODPROBE" "$TUNING_TMPFILES" "$TUNING_RULES"; do
+        mv -f "$file.new" "$file"
+    done
+    udevadm control --reload-rules 2>/dev/null
+    verify_tuning | tail -n 1
+}
+
+# Check if running as root; the preflight check only reads files
+if [ "$EUID" -ne 0 ] && [ $PREFLIGHT_ONLY -eq 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+# Bundles from build-modules.sh hold one directory of modules per kernel
+# release and the running release is installed; older bundles hold the
+# 5.15.148-tegra modules directly
+LEGACY_RELEASE="5.15.148-tegra"
+KERNEL_RELEASE=$(uname -r)
+DEPMOD_CONF="/etc/depmod.d/jetson-modules.conf"
+
+# Early boot registration, see --early-boot below
+MODULES_LOAD_CONF="/etc/modules-load.d/jetson-modules.conf"
+MODPROBE_CONF="/etc/modprobe.d/jetson-modules.conf"
+NV_INITRD_LIST="/etc/nv-update-initrd/list.d/jetson-modules"
+INITRAMFS_MODULES="/etc/initramfs-tools/modules"
+
+# Rebuild the initramfs of the running kernel with whichever tool the
+# system uses
+update_initrd() {
+    echo "Updating initramfs..."
+    if command -v nv-update-initrd >/dev/null; then
+        nv-update-initrd >/dev/null || { echo "Failed to update initramfs"; exit 1; }
+    elif command -v update-initramfs >/dev/null; then
+        update-initramfs -u -k "$KERNEL_RELEASE" >/dev/null || { echo "Failed to update initramfs"; exit 1; }
+    fi
+}
+
+# The installed modules stay in place and loaded; they are loaded by udev
+# again from the next boot on
+if [ $NO_EARLY_BOOT -eq 1 ]; then
+    if [ ! -f "$MODULES_LOAD_CONF" ] && [ ! -f "$MODPROBE_CONF" ] && [ ! -f "$NV_INITRD_LIST" ] &&
+       ! grep -qs '# jetson-modules begin' "$INITRAMFS_MODULES"; then
+        echo "Early boot is not enabled"
+        exit 0
+    fi
+    echo "Removing the early boot registration..."
+    [ -f "$MODPROBE_CONF" ] && grep '^options' "$MODPROBE_CONF" | sed 's/^/  dropped: /'
+    rm -f "$MODULES_LOAD_CONF" "$MODPROBE_CONF" "$NV_INITRD_LIST" "$BOOT_REPORT_DIR/boot-report.before"
+    [ -f "$INITRAMFS_MODULES" ] && sed -i '/# jetson-modules begin/,/# jetson-modules end/d' "$INITRAMFS_MODULES"
+    update_initrd
+    echo "Early boot disabled; the modules load through udev from the next boot on."
+    exit 0
+fi
+
+# Point the module set locations at a kernel release
+set_release() {
+    KERNEL_RELEASE="$1"
+    SETS_DIR="/lib/modules/jetson-modules/$KERNEL_RELEASE"
+    PREVIOUS_LINK="$SETS_DIR/previous"
+    ACTIVE_LINK="/lib/modules/$KERNEL_RELEASE/updates/jetson-modules"
+}
+
+# List of files to check and their corresponding module names
+FILES=(
+    "uvcvideo.ko:uvcvideo"
+    "hid-sensor-accel-3d.ko:hid_sensor_accel_3d"
+    "hid-sensor-iio-common.ko:hid_sensor_iio_common"
+    "hid-sensor-hub.ko:hid_sensor_hub"
+    "hid-sensor-trigger.ko:hid_sensor_trigger"
+    "hid-sensor-gyro-3d.ko:hid_sensor_gyro_3d"
+    "gs_usb.ko:gs_usb"
+)
+
+# udev rules giving each camera's IMU IIO devices stable names
+UDEV_RULES=("99-jetson-iio.rules" "98-jetson-boot-timing.rules")
+UDEV_HELPER="iio-usb-id"
+UDEV_RULES_DIR="/etc/udev/rules.d"
+HELPER_DIR="/usr/local/lib/jetson-modules"
+
+# Post-install camera and CAN measurements, run by --self-test
+SELFTEST="jetson-selftest.py"
+
+# Per-stage camera and CAN latency histograms, run by hand with bpftrace
+# from the active module set
+LATENCY_PROBES="jetson-latency.bt"
+
+# Temporary directories, removed however the script exits
+STAGE_DIR=""
+STATE_DIR=""
+trap 'rm -rf "$STAGE_DIR" "$STATE_DIR"' EXIT
+
+# Directory the bundled files are read from, and the one holding the
+# modules for $KERNEL_RELEASE
+SRC_DIR="."
+MODULE_DIR=""
+
+# Rolling back reinstalls the previous module set from its own directory
+if [ $ROLLBACK -eq 1 ]; then
+    [ -z "$BUNDLE" ] || { echo "Error: --rollback cannot be combined with --bundle"; exit 1; }
+    [ -L "/lib/modules/jetson-modules/$KERNEL_RELEASE/previous" ] || KERNEL_RELEASE="$LEGACY_RELEASE"
+    set_release "$KERNEL_RELEASE"
+    SRC_DIR=$(readlink "$PREVIOUS_LINK")
+    [ -n "$SRC_DIR" ] && [ -d "$SRC_DIR" ] || { echo "Error: no previous module set to roll back to"; exit 1; }
+    echo "Rolling back to module set ${SRC_DIR##*/}..."
+    MODULE_DIR="$SRC_DIR"
+fi
+
+# In bundle mode the tarball is read once: the compressed stream is
+# hashed while tar unpacks each member into a staging directory under
+# /lib/modules, so installing is a rename on the same filesystem and no
+# extracted tree is left behind. The staging directory sits outside the
+# kernel release tree so depmod never sees the staged copies. Of the
+# per-release module directories only the running release is unpacked.
+if [ -n "$BUNDLE" ]; then
+    [ -f "$BUNDLE" ] || { echo "Error: $BUNDLE not found"; exit 1; }
+    [ -f "$BUNDLE.sha256" ] || { echo "Error: $BUNDLE.sha256 not found"; exit 1; }
+    expected=$(cut -d ' ' -f 1 "$BUNDLE.sha256")
+
+    stage_parent="/lib/modules"
+    [ -w "$stage_parent" ] || stage_parent="${TMPDIR:-/tmp}"
+    STAGE_DIR=$(mktemp -d "$stage_parent/.jetson-modules.XXXXXX") || { echo "Failed to create staging directory"; exit 1; }
+
+    echo "Streaming $BUNDLE..."
+    export STAGE_DIR KERNEL_RELEASE
+    tee >(sha256sum | cut -d ' ' -f 1 > "$STAGE_DIR/.sha256") < "$BUNDLE" |
+        tar -xz --to-command='
+            name="${TAR_FILENAME#*/}"
+            case "$name" in
+                "$KERNEL_RELEASE"/*) mkdir -p "$STAGE_DIR/$KERNEL_RELEASE" ;;
+                */*) echo "${name%%/*}" >> "$STAGE_DIR/.releases"; cat > /dev/null; exit 0 ;;
+            esac
+            cat > "$STAGE_DIR/$name"'
+    tar_status=$?
+    wait $!
+    [ $tar_status -eq 0 ] || { echo "Error: failed to unpack $BUNDLE"; exit 1; }
+    actual=$(cat "$STAGE_DIR/.sha256")
+    if [ "$actual" != "$expected" ]; then
+        echo "Error: checksum mismatch for $BUNDLE"
+        echo "  expected $expected"
+        echo "  got      $actual"
+        exit 1
+    fi
+    echo "Checksum OK."
+    SRC_DIR="$STAGE_DIR"
+fi
+
+# Install one file by write-then-rename, so the destination never holds
+# a partial module. Staged files on the same filesystem are just renamed.
+install_file() {
+    local src="$1" dest="$2" mode="$3"
+    if [ -n "$STAGE_DIR" ] && [[ "$src" == "$STAGE_DIR"/* ]] &&
+       [ "$(stat -c %d "$src")" = "$(stat -c %d "$(dirname "$dest")")" ]; then
+        chmod "$mode" "$src" && mv -f "$src" "$dest"
+    else
+        cp "$src" "$dest.new" && chmod "$mode" "$dest.new" && mv -f "$dest.new" "$dest"
+    fi
+}
+
+# Pick the modules for the running kernel from a per-release bundle, or
+# fall back to the flat layout of older bundles
+if [ -z "$MODULE_DIR" ]; then
+    if [ -d "$SRC_DIR/$KERNEL_RELEASE" ]; then
+        MODULE_DIR="$SRC_DIR/$KERNEL_RELEASE"
+    elif [ -f "$SRC_DIR/${FILES[0]%%:*}" ]; then
+        MODULE_DIR="$SRC_DIR"
+        KERNEL_RELEASE="$LEGACY_RELEASE"
+    else
+        releases=$( { cat "$SRC_DIR/.releases" 2>/dev/null
+                      for dir in "$SRC_DIR"/*/; do [ -f "$dir${FILES[0]%%:*}" ] && basename "$dir"; done; } | sort -u | xargs)
+        echo "Error: no modules for kernel $KERNEL_RELEASE in ${BUNDLE:-current directory}"
+        [ -n "$releases" ] && echo "  bundle has modules for: $releases"
+        exit 1
+    fi
+    set_release "$KERNEL_RELEASE"
+fi
+
+# Check if all files exist first
+echo "Checking for required files..."
+for entry in "${FILES[@]}"; do
+    IFS=: read -r file module <<< "$entry"
+    if [ ! -f "$MODULE_DIR/$file" ]; then
+        echo "Error: $file not found in ${BUNDLE:-current directory}"
+        exit 1
+    fi
+done
+for file in "${UDEV_RULES[@]}" "$UDEV_HELPER" "$TUNING_PROFILE" "$SELFTEST" "$LATENCY_PROBES"; do
+    if [ ! -f "$SRC_DIR/$file" ]; then
+        echo "Error: $file not found in ${BUNDLE:-current directory}"
+        exit 1
+    fi
+done
+echo "All required files found."
+
+# Check every bundled module against the running kernel before anything
+# is installed: vermagic flags and release, and the CRC of each imported
+# symbol. Symbols are resolved against the bundle itself, the kernel's
+# Module.symvers, the exporting module on disk, and finally
+# /proc/kallsyms (name only). All problems are reported in one pass.
+run_preflight() {
+    local errors=0 warnings=0 running ref_vermagic ref_flags symvers ref
+    local file module vermagic release flags crc sym want have provider path
+    local line bad unverified checked dump
+    local -A BUNDLE_CRC KERNEL_CRC KSYMTAB PROVIDER PROVIDER_CRC SCANNED
+    local -a versions
+
+    # Without these every module would look like it has no vermagic and
+    # no symbol CRCs
+    for ref in modinfo modprobe; do
+        if ! command -v "$ref" >/dev/null; then
+            echo "  ERROR: $ref not found; install kmod to check the modules"
+            return 1
+        fi
+    done
+
+    running=$(uname -r)
+    if [ "$running" != "$KERNEL_RELEASE" ]; then
+        echo "  ERROR: running kernel is $running, bundle targets $KERNEL_RELEASE"
+        errors=$((errors + 1))
+    fi
+
+    # vermagic flags of a stock module show how the running kernel was built
+    for ref in videodev can_dev industrialio hid; do
+        ref_vermagic=$(modinfo -F vermagic "$ref" 2>/dev/null) && [ -n "$ref_vermagic" ] && break
+    done
+    ref_flags="${ref_vermagic#* }"
+
+    # Exports of the bundled modules, with CRCs when nm is available
+    for entry in "${FILES[@]}"; do
+        IFS=: read -r file module <<< "$entry"
+        if command -v nm >/dev/null; then
+            while read -r crc _ sym; do
+                BUNDLE_CRC[${sym#__crc_}]=$((16#$crc))
+            done < <(nm "$MODULE_DIR/$file" 2>/dev/null | grep ' __crc_')
+        else
+            for sym in $(grep -aoE '__crc_[A-Za-z0-9_]+' "$MODULE_DIR/$file"); do
+                BUNDLE_CRC[${sym#__crc_}]=""
+            done
+        fi
+    done
+
+    for symvers in "/lib/modules/$running/build/Module.symvers" "/boot/symvers-$running.gz"; do
+        [ -r "$symvers" ] || continue
+        while read -r crc sym _; do
+            KERNEL_CRC[$sym]=$((crc))
+        done < <(zcat -f "$symvers")
+        break
+    done
+    while read -r _ _ sym; do
+        KSYMTAB[${sym#__ksymtab_}]=1
+    done < <(grep ' __ksymtab_' /proc/kallsyms 2>/dev/null)
+    while read -r _ sym provider; do
+        PROVIDER[${sym#symbol:}]=$provider
+    done < <(cat "/lib/modules/$running/modules.symbols" 2>/dev/null)
+
+    for entry in "${FILES[@]}"; do
+        IFS=: read -r file module <<< "$entry"
+        bad=0 unverified=0 checked=0
+
+        if ! dump=$(modprobe --dump-modversions "$MODULE_DIR/$file" 2>/dev/null); then
+            echo "  ERROR: $file: cannot read its symbol CRCs:" \
+                 "$(modprobe --dump-modversions "$MODULE_DIR/$file" 2>&1 >/dev/null | head -n 1)"
+            errors=$((errors + 1))
+            continue
+        fi
+        mapfile -t versions <<< "$dump"
+        for line in "${versions[@]}"; do
+            [ -n "$line" ] || continue
+            read -r crc sym <<< "$line"
+            want=$((crc))
+            checked=$((checked + 1))
+            if [ -n "${BUNDLE_CRC[$sym]+x}" ]; then
+                have="${BUNDLE_CRC[$sym]}"
+                provider="bundle"
+            elif [ -n "${KERNEL_CRC[$sym]+x}" ]; then
+                have="${KERNEL_CRC[$sym]}"
+                provider="Module.symvers"
+            elif [ -n "${PROVIDER[$sym]}" ]; then
+                provider="${PROVIDER[$sym]}"
+                # Read all CRCs of an exporting module the first time it is needed
+                if [ -z "${SCANNED[$provider]}" ] && path=$(modinfo -n "$provider" 2>/dev/null); then
+                    while read -r crc _ ref; do
+                        PROVIDER_CRC[${ref#__crc_}]=$((16#$crc))
+                    done < <(nm "$path" 2>/dev/null | grep ' __crc_')
+                fi
+                SCANNED[$provider]=1
+                have="${PROVIDER_CRC[$sym]}"
+            elif [ -n "${KSYMTAB[$sym]}" ]; then
+                have=""
+                provider="kallsyms"
+            else
+                echo "  ERROR: $file: unresolved symbol $sym"
+                bad=$((bad + 1))
+                continue
+            fi
+            if [ -z "$have" ]; then
+                unverified=$((unverified + 1))
+            elif [ "$have" -ne "$want" ]; then
+                printf "  ERROR: %s: %s CRC 0x%08x, %s has 0x%08x\n" "$file" "$sym" "$want" "$provider" "$have"
+                bad=$((bad + 1))
+            fi
+        done
+        errors=$((errors + bad))
+
+        # The kernel only compares the release part of vermagic when the
+        # module has no modversions; the flags must always match
+        vermagic=$(modinfo -F vermagic "$MODULE_DIR/$file" 2>/dev/null)
+        release="${vermagic%% *}"
+        flags="${vermagic#* }"
+        if [ -z "$vermagic" ]; then
+            echo "  ERROR: $file: no vermagic"
+            errors=$((errors + 1))
+        elif [ -n "$ref_flags" ] && [ "$flags" != "$ref_flags" ]; then
+            echo "  ERROR: $file: vermagic flags '$flags', kernel has '$ref_flags'"
+            errors=$((errors + 1))
+        elif [ "$release" != "$running" ]; then
+            if [ $checked -eq 0 ] || [ $bad -gt 0 ]; then
+                echo "  ERROR: $file: vermagic $release != $running and its CRCs do not vouch for it"
+                errors=$((errors + 1))
+            else
+                echo "  WARNING: $file: vermagic $release != $running (accepted via modversions)"
+                warnings=$((warnings + 1))
+            fi
+        fi
+
+        if [ $unverified -gt 0 ]; then
+            echo "  WARNING: $file: $unverified of $checked symbol CRCs could not be verified"
+            warnings=$((warnings + 1))
+        fi
+        [ $bad -eq 0 ] && echo "  $file: $checked symbols checked"
+    done
+
+    [ -z "$ref_vermagic" ] && { echo "  WARNING: no stock module found to compare vermagic flags"; warnings=$((warnings + 1)); }
+    echo "Preflight: $errors error(s), $warnings warning(s)"
+    [ $errors -eq 0 ]
+}
+
+if [ $PREFLIGHT -eq 1 ] || [ $PREFLIGHT_ONLY -eq 1 ]; then
+    echo "Checking modules against the running kernel..."
+    run_preflight || { echo "Error: preflight failed, nothing was installed"; exit 1; }
+fi
+[ $PREFLIGHT_ONLY -eq 1 ] && exit 0
+
+# Build the dependency graph of the bundled modules from their depends=
+# info, keeping only dependencies that are part of this bundle
+echo "Resolving module dependencies..."
+declare -A MODULE_DEPS MODULE_LEVEL
+MODULES=()
+for entry in "${FILES[@]}"; do
+    IFS=: read -r file module <<< "$entry"
+    MODULES+=("$module")
+done
+for entry in "${FILES[@]}"; do
+    IFS=: read -r file module <<< "$entry"
+    MODULE_DEPS[$module]=""
+    for dep in $(modinfo -F depends "$MODULE_DIR/$file" 2>/dev/null | tr ',-' ' _'); do
+        if [[ " ${MODULES[*]} " == *" $dep "* ]]; then
+            MODULE_DEPS[$module]+="$dep "
+        fi
+    done
+done
+
+# Level 0 modules have no bundled dependencies; every other module sits
+# one level above its deepest dependency
+MAX_LEVEL=0
+remaining=("${MODULES[@]}")
+while [ ${#remaining[@]} -gt 0 ]; do
+    pending=()
+    for module in "${remaining[@]}"; do
+        level=0
+        for dep in ${MODULE_DEPS[$module]}; do
+            if [ -z "${MODULE_LEVEL[$dep]}" ]; then
+                level=-1
+                break
+            fi
+            (( MODULE_LEVEL[$dep] + 1 > level )) && level=$(( MODULE_LEVEL[$dep] + 1 ))
+        done
+        if [ $level -lt 0 ]; then
+            pending+=("$module")
+        else
+            MODULE_LEVEL[$module]=$level
+            (( level > MAX_LEVEL )) && MAX_LEVEL=$level
+        fi
+    done
+    if [ ${#pending[@]} -eq ${#remaining[@]} ]; then
+        echo "Error: circular dependency between ${pending[*]}"
+        exit 1
+    fi
+    remaining=("${pending[@]}")
+done
+
+# Every bundle becomes a module set named after a hash of its contents,
+# so installing the same bundle twice finds its set already in place
+echo "Installing kernel modules..."
+declare -A CHANGED RELOAD
+set_files=()
+for file in "${FILES[@]%%:*}"; do
+    set_files+=("$MODULE_DIR/$file")
+done
+for file in "${UDEV_RULES[@]}" "$UDEV_HELPER" "$TUNING_PROFILE" "$SELFTEST" "$LATENCY_PROBES"; do
+    # build-modules.sh puts latency probes with the struct offsets of its
+    # uvcvideo.ko next to the modules of each release
+    if [ "$file" = "$LATENCY_PROBES" ] && [ -f "$MODULE_DIR/$file" ]; then
+        set_files+=("$MODULE_DIR/$file")
+    else
+        set_files+=("$SRC_DIR/$file")
+    fi
+done
+set_id=$(for path in "${set_files[@]}"; do
+             sha256sum < "$path"
+         done | sha256sum | cut -c 1-12)
+# The links hold absolute paths under $SETS_DIR, so they are compared
+# as written rather than canonicalized (/lib may itself be a symlink)
+set_dir="$SETS_DIR/$set_id"
+active_dir=$(readlink "$ACTIVE_LINK")
+
+if [ ! -d "$set_dir" ]; then
+    mkdir -p "$SETS_DIR"
+    rm -rf "$set_dir.new"
+    mkdir "$set_dir.new" || { echo "Failed to create module set $set_id"; exit 1; }
+    for path in "${set_files[@]}"; do
+        install_file "$path" "$set_dir.new/${path##*/}" 644 || { echo "Failed to install ${path##*/}"; exit 1; }
+    done
+    mv -T "$set_dir.new" "$set_dir" || { echo "Failed to create module set $set_id"; exit 1; }
+fi
+SRC_DIR="$set_dir"
+MODULE_DIR="$set_dir"
+
+for entry in "${FILES[@]}"; do
+    IFS=: read -r file module <<< "$entry"
+    if [ $FORCE -eq 0 ] && [ -n "$active_dir" ] && cmp -s "$set_dir/$file" "$active_dir/$file"; then
+        echo "  $file: up to date"
+        continue
+    fi
+    echo "  $file: installed"
+    CHANGED[$module]=1
+done
+
+# Switch the active set with a single rename of its symlink; the set it
+# replaces is remembered for --rollback
+if [ "$active_dir" != "$set_dir" ]; then
+    mkdir -p "$(dirname "$ACTIVE_LINK")"
+    ln -sfn "$set_dir" "$ACTIVE_LINK.new" && mv -T "$ACTIVE_LINK.new" "$ACTIVE_LINK" || { echo "Failed to activate module set $set_id"; exit 1; }
+    if [ -n "$active_dir" ] && [ -d "$active_dir" ]; then
+        ln -sfn "$active_dir" "$PREVIOUS_LINK.new" && mv -T "$PREVIOUS_LINK.new" "$PREVIOUS_LINK"
+    fi
+    echo "Module set $set_id active${active_dir:+ (previous: ${active_dir##*/})}"
+
+    # Only the active and the previous set are kept
+    previous_dir=$(readlink "$PREVIOUS_LINK")
+    for dir in "$SETS_DIR"/*/; do
+        dir="${dir%/}"
+        [ -L "$dir" ] && continue
+        [ "$dir" = "$set_dir" ] || [ "$dir" = "$previous_dir" ] || rm -rf "$dir"
+    done
+fi
+
+# Make depmod pick the active set over the stock modules in kernel/
+depmod_conf="# Installed by install-jetson-modules.sh
+$(for module in "${MODULES[@]}"; do echo "override $module $KERNEL_RELEASE updates/jetson-modules"; done)"
+if [ "$(cat "$DEPMOD_CONF" 2>/dev/null)" != "$depmod_conf" ]; then
+    mkdir -p "$(dirname "$DEPMOD_CONF")"
+    echo "$depmod_conf" > "$DEPMOD_CONF"
+    for module in "${MODULES[@]}"; do
+        CHANGED[$module]=1
+    done
+fi
+
+# Install udev naming rules before the modules are (re)loaded
+echo "Installing udev rules..."
+mkdir -p "$HELPER_DIR" "$UDEV_RULES_DIR"
+udev_changed=0
+if [ $FORCE -eq 1 ] || ! cmp -s "$SRC_DIR/$UDEV_HELPER" "$HELPER_DIR/$UDEV_HELPER"; then
+    install_file "$SRC_DIR/$UDEV_HELPER" "$HELPER_DIR/$UDEV_HELPER" 755 || { echo "Failed to install $UDEV_HELPER"; exit 1; }
+    udev_changed=1
+fi
+for file in "${UDEV_RULES[@]}"; do
+    if [ $FORCE -eq 1 ] || ! cmp -s "$SRC_DIR/$file" "$UDEV_RULES_DIR/$file"; then
+        install_file "$SRC_DIR/$file" "$UDEV_RULES_DIR/$file" 644 || { echo "Failed to install $file"; exit 1; }
+        udev_changed=1
+    fi
+done
+[ $udev_changed -eq 1 ] && udevadm control --reload-rules 2>/dev/null
+
+# Update module dependencies; not needed when no module file changed
+if [ ${#CHANGED[@]} -gt 0 ]; then
+    echo "Updating module dependencies..."
+    depmod -a "$KERNEL_RELEASE" || { echo "Failed to update module dependencies"; exit 1; }
+else
+    echo "Module files unchanged, skipping depmod."
+fi
+
+# Early boot: list the modules in modules-load.d, preset their parameters
+# in modprobe.d and put them in the initramfs. Once registered, the
+# initramfs is rebuilt whenever a module file changes so it never carries
+# stale copies.
+rebuild_initrd=0
+if [ $EARLY_BOOT -eq 1 ]; then
+    echo "Registering modules for early boot..."
+    mkdir -p "$BOOT_REPORT_DIR" "$(dirname "$MODULES_LOAD_CONF")" "$(dirname "$MODPROBE_CONF")"
+
+    # Remember how late the devices came up before early loading; kept
+    # from the first registration so later runs compare against it
+    [ -s "$BOOT_REPORT_DIR/boot-report.before" ] || boot_report > "$BOOT_REPORT_DIR/boot-report.before"
+
+    {
+        echo "# Installed by install-jetson-modules.sh --early-boot"
+        for (( level = 0; level <= MAX_LEVEL; level++ )); do
+            for module in "${MODULES[@]}"; do
+                if [ "${MODULE_LEVEL[$module]}" -eq "$level" ]; then
+                    echo "$module"
+                fi
+            done
+        done
+    } > "$MODULES_LOAD_CONF.new" && mv -f "$MODULES_LOAD_CONF.new" "$MODULES_LOAD_CONF"
+
+    # Parameters preset by earlier runs stay unless --param sets them
+    # again; modprobe does not tell - from _ in module names
+    declare -A NEW_PARAM
+    for param in "${PARAMS[@]}"; do
+        param="${param%%=*}"
+        NEW_PARAM[${param//-/_}]=1
+    done
+    kept=()
+    if [ -f "$MODPROBE_CONF" ]; then
+        while read -r keyword module setting; do
+            [ "$keyword" = "options" ] && [ -n "$setting" ] || continue
+            param="${module//-/_}.${setting%%=*}"
+            [ -n "${NEW_PARAM[$param]}" ] || kept+=("$module $setting")
+        done < "$MODPROBE_CONF"
+    fi
+    {
+        echo "# Installed by install-jetson-modules.sh --early-boot"
+        for param in "${kept[@]}"; do
+            echo "options $param"
+        done
+        for param in "${PARAMS[@]}"; do
+            echo "options ${param%%.*} ${param#*.}"
+        done
+    } > "$MODPROBE_CONF.new" && mv -f "$MODPROBE_CONF.new" "$MODPROBE_CONF"
+    for param in "${kept[@]}"; do
+        echo "  kept: options $param"
+    done
+
+    if command -v nv-update-initrd >/dev/null; then
+        mkdir -p "$(dirname "$NV_INITRD_LIST")"
+        for entry in "${FILES[@]}"; do
+            IFS=: read -r file module <<< "$entry"
+            echo "$ACTIVE_LINK/$file"
+        done > "$NV_INITRD_LIST"
+        rebuild_initrd=1
+    elif [ -f "$INITRAMFS_MODULES" ]; then
+        sed -i '/# jetson-modules begin/,/# jetson-modules end/d' "$INITRAMFS_MODULES"
+        {
+            echo "# jetson-modules begin"
+            printf "%s\n" "${MODULES[@]}"
+            echo "# jetson-modules end"
+        } >> "$INITRAMFS_MODULES"
+        rebuild_initrd=1
+    else
+        echo "Warning: neither nv-update-initrd nor initramfs-tools found, using modules-load.d only"
+    fi
+    echo "Early boot enabled; reboot, then run --boot-report to compare device availability."
+elif [ ${#CHANGED[@]} -gt 0 ] && { [ -f "$NV_INITRD_LIST" ] || grep -qs '# jetson-modules begin' "$INITRAMFS_MODULES"; }; then
+    rebuild_initrd=1
+fi
+
+[ $rebuild_initrd -eq 1 ] && update_initrd
+
+# A module is reloaded when its file changed, it is not loaded, or the
+# running copy's srcversion differs from the bundle. Modules without a
+# srcversion are trusted if their file is unchanged.
+for entry in "${FILES[@]}"; do
+    IFS=: read -r file module <<< "$entry"
+    if [ $FORCE -eq 1 ] || [ -n "${CHANGED[$module]}" ] || [ ! -d "/sys/module/$module" ]; then
+        RELOAD[$module]=1
+        continue
+    fi
+    srcversion=$(modinfo -F srcversion "$MODULE_DIR/$file" 2>/dev/null)
+    if [ -n "$srcversion" ] && [ -r "/sys/module/$module/srcversion" ] &&
+       [ "$(cat "/sys/module/$module/srcversion")" != "$srcversion" ]; then
+        RELOAD[$module]=1
+    fi
+done
+
+# Reloading a module means unloading everything in the bundle that uses
+# it, so those modules are reloaded as well
+for (( level = 0; level <= MAX_LEVEL; level++ )); do
+    for module in "${MODULES[@]}"; do
+        [ "${MODULE_LEVEL[$module]}" -eq "$level" ] || continue
+        for dep in ${MODULE_DEPS[$module]}; do
+            [ -n "${RELOAD[$dep]}" ] && RELOAD[$module]=1
+        done
+    done
+done
+
+# Stream the cameras and exercise the CAN adapters against the selftest
+# thresholds of the profile
+self_test() {
+    command -v python3 > /dev/null || { echo "Error: --self-test needs python3"; return 1; }
+    echo "Running self-test..."
+    # Let the devices of freshly loaded modules finish enumerating
+    udevadm settle 2>/dev/null
+    python3 "$SRC_DIR/$SELFTEST" --profile "${TUNE_PROFILE:-$SRC_DIR/$TUNING_PROFILE}" && return 0
+    echo "Self-test failed; use --rollback to return to the previous module set"
+    return 1
+}
+
+if [ ${#RELOAD[@]} -eq 0 ]; then
+    [ $udev_changed -eq 1 ] && udevadm trigger --subsystem-match=iio --action=add 2>/dev/null
+    [ $TUNE -eq 1 ] && apply_tuning "${TUNE_PROFILE:-$SRC_DIR/$TUNING_PROFILE}"
+    echo "All kernel modules are up to date"
+    [ $SELF_TEST -eq 1 ] && { self_test || exit 1; }
+    exit 0
+fi
+
+# Unload the old modules once, dependents before the modules they use
+echo "Unloading old kernel modules..."
+for (( level = MAX_LEVEL; level >= 0; level-- )); do
+    for module in "${MODULES[@]}"; do
+        [ "${MODULE_LEVEL[$module]}" -eq "$level" ] || continue
+        [ -n "${RELOAD[$module]}" ] || continue
+        # Skip modules that are not loaded or went away with a dependent
+        [ -d "/sys/module/$module" ] || continue
+        modprobe -r "$module" 2>/dev/null || echo "Warning: could not unload $module (in use?)"
+    done
+done
+
+# Load a module once all of its reloaded dependencies have finished.
+# Runs in the background; progress is exchanged through $STATE_DIR.
+load_module() {
+    local module="$1" dep start end
+    for dep in ${MODULE_DEPS[$module]}; do
+        [ -n "${RELOAD[$dep]}" ] || continue
+        until [ -e "$STATE_DIR/$dep.done" ]; do
+            sleep 0.02
+        done
+        if [ -e "$STATE_DIR/$dep.failed" ]; then
+            echo "skipped, $dep failed to load" > "$STATE_DIR/$module.err"
+            touch "$STATE_DIR/$module.failed" "$STATE_DIR/$module.done"
+            return
+        fi
+    done
+    start=$(date +%s%N)
+    modprobe "$module" 2>"$STATE_DIR/$module.err" || touch "$STATE_DIR/$module.failed"
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 )) > "$STATE_DIR/$module.ms"
+    touch "$STATE_DIR/$module.done"
+}
+
+# Load the modules; independent chains (uvcvideo, gs_usb, hid-sensor-*)
+# come up in parallel
+echo "Loading kernel modules..."
+STATE_DIR=$(mktemp -d) || { echo "Failed to create temporary directory"; exit 1; }
+load_start=$(date +%s%N)
+for module in "${MODULES[@]}"; do
+    [ -n "${RELOAD[$module]}" ] && load_module "$module" &
+done
+wait
+load_end=$(date +%s%N)
+
+failed=0
+for (( level = 0; level <= MAX_LEVEL; level++ )); do
+    for module in "${MODULES[@]}"; do
+        [ "${MODULE_LEVEL[$module]}" -eq "$level" ] || continue
+        [ -n "${RELOAD[$module]}" ] || continue
+        if [ -e "$STATE_DIR/$module.failed" ]; then
+            echo "  $module: FAILED ($(head -n 1 "$STATE_DIR/$module.err"))"
+            failed=1
+        else
+            printf "  %-24s %6s ms\n" "$module" "$(cat "$STATE_DIR/$module.ms")"
+        fi
+    done
+done
+echo "Modules loaded in $(( (load_end - load_start) / 1000000 )) ms"
+[ $failed -eq 0 ] || { echo "Failed to load kernel modules"; exit 1; }
+
+# Name IIO devices that were already present before the rules existed
+udevadm trigger --subsystem-match=iio --action=add 2>/dev/null
+
+# Tune after loading so the new modules' parameters can be set at once
+[ $TUNE -eq 1 ] && apply_tuning "${TUNE_PROFILE:-$SRC_DIR/$TUNING_PROFILE}"
+
+echo "All kernel modules installed and loaded successfully"
+[ $SELF_TEST -eq 1 ] && { self_test || exit 1; }
@@ -0,0 +1,701 @@
+#!/usr/bin/env python3
+
+# Post-install camera, CAN and IMU self-test
+#
+# Streams every uvcvideo capture node for a few seconds and measures
+# frame rate, dropped frames (sequence gaps and error buffers) and
+# dequeue latency against the buffer timestamps, plus the kernel CPU
+# time per frame and the driver's own counters from debugfs. Every
+# gs_usb interface that is not in use is switched to loopback mode and
+# driven with a burst of frames to measure frame rate, TX-to-echo
+# latency and kernel CPU time per frame. The IIO buffers of the
+# RealSense IMU (accel_3d, gyro_3d) are read to measure the sample rate,
+# samples lost according to the timestamps, delivery latency and kernel
+# CPU time per sample.
+#
+# Thresholds come from the "selftest" lines of the tuning profile; the
+# exit status is non-zero if any measurement falls outside them.
+#
+# Usage: jetson-selftest.py [--profile FILE] [--duration SECONDS]
+#                           [--device /dev/videoN [--format FOURCC:WxH]]...
+#                           [--can IFACE]... [--iio iio:deviceN]...
+#                           [--json FILE]
+#
+# With --device only the given capture nodes are streamed, in the order
+# given, each in the format of the --format that follows it if any; with
+# --can and --iio only the given CAN interfaces and IIO devices are
+# tested. Anything not named is then skipped. --json also writes the
+# measurements to FILE, one object per device.
+
+import argparse
+import ctypes
+import errno
+import fcntl
+import glob
+import json
+import mmap
+import os
+import select
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+DEFAULTS = {
+    "duration": 3.0,
+    "uvc-min-fps": 25.0,
+    "uvc-max-drop-pct": 1.0,
+    "uvc-max-latency-ms": 50.0,
+    "can-bitrate": 1000000,
+    "can-frames": 2000,
+    "can-min-fps": 1000.0,
+    "can-max-echo-us": 2000.0,
+    "imu-max-loss-pct": 1.0,
+    "imu-max-latency-ms": 20.0,
+}
+
+
+def read_thresholds(profile):
+    limits = dict(DEFAULTS)
+    if not profile or not os.path.exists(profile):
+        return limits
+    with open(profile) as f:
+        for line in f:
+            fields = line.split("#", 1)[0].split()
+            if len(fields) == 3 and fields[0] == "selftest" and fields[1] in limits:
+                limits[fields[1]] = type(DEFAULTS[fields[1]])(float(fields[2]))
+    return limits
+
+
+# V4L2 ABI (include/uapi/linux/videodev2.h), 64-bit layout
+
+class v4l2_capability(ctypes.Structure):
+    _fields_ = [("driver", ctypes.c_char * 16), ("card", ctypes.c_char * 32),
+                ("bus_info", ctypes.c_char * 32), ("version", ctypes.c_uint32),
+                ("capabilities", ctypes.c_uint32), ("device_caps", ctypes.c_uint32),
+                ("reserved", ctypes.c_uint32 * 3)]
+
+
+class v4l2_requestbuffers(ctypes.Structure):
+    _fields_ = [("count", ctypes.c_uint32), ("type", ctypes.c_uint32),
+                ("memory", ctypes.c_uint32), ("capabilities", ctypes.c_uint32),
+                ("reserved", ctypes.c_uint32)]
+
+
+class timeval(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_usec", ctypes.c_long)]
+
+
+class v4l2_timecode(ctypes.Structure):
+    _fields_ = [("type", ctypes.c_uint32), ("flags", ctypes.c_uint32),
+                ("frames", ctypes.c_uint8), ("seconds", ctypes.c_uint8),
+                ("minutes", ctypes.c_uint8), ("hours", ctypes.c_uint8),
+                ("userbits", ctypes.c_uint8 * 4)]
+
+
+class v4l2_buffer_m(ctypes.Union):
+    _fields_ = [("offset", ctypes.c_uint32), ("userptr", ctypes.c_ulong),
+                ("planes", ctypes.c_void_p), ("fd", ctypes.c_int32)]
+
+
+class v4l2_buffer(ctypes.Structure):
+    _fields_ = [("index", ctypes.c_uint32), ("type", ctypes.c_uint32),
+                ("bytesused", ctypes.c_uint32), ("flags", ctypes.c_uint32),
+                ("field", ctypes.c_uint32), ("timestamp", timeval),
+                ("timecode", v4l2_timecode), ("sequence", ctypes.c_uint32),
+                ("memory", ctypes.c_uint32), ("m", v4l2_buffer_m),
+                ("length", ctypes.c_uint32), ("reserved2", ctypes.c_uint32),
+                ("request_fd", ctypes.c_int32)]
+
+
+class v4l2_pix_format(ctypes.Structure):
+    _fields_ = [("width", ctypes.c_uint32), ("height", ctypes.c_uint32),
+                ("pixelformat", ctypes.c_uint32), ("field", ctypes.c_uint32),
+                ("bytesperline", ctypes.c_uint32), ("sizeimage", ctypes.c_uint32),
+                ("colorspace", ctypes.c_uint32), ("priv", ctypes.c_uint32),
+                ("flags", ctypes.c_uint32), ("ycbcr_enc", ctypes.c_uint32),
+                ("quantization", ctypes.c_uint32), ("xfer_func", ctypes.c_uint32)]
+
+
+class v4l2_format_fmt(ctypes.Union):
+    _fields_ = [("pix", v4l2_pix_format), ("raw_data", ctypes.c_uint8 * 200),
+                ("align", ctypes.c_void_p)]
+
+
+class v4l2_format(ctypes.Structure):
+    _fields_ = [("type", ctypes.c_uint32), ("fmt", v4l2_format_fmt)]
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of a sorted list, None if it is empty"""
+    if not values:
+        return None
+    return values[min(len(values) - 1, int(len(values) * pct / 100.0))]
+
+
+def _ioc(direction, nr, size):
+    return (direction << 30) | (size << 16) | (ord("V") << 8) | nr
+
+
+VIDIOC_QUERYCAP = _ioc(2, 0, ctypes.sizeof(v4l2_capability))
+VIDIOC_S_FMT = _ioc(3, 5, ctypes.sizeof(v4l2_format))
+VIDIOC_REQBUFS = _ioc(3, 8, ctypes.sizeof(v4l2_requestbuffers))
+VIDIOC_QUERYBUF = _ioc(3, 9, ctypes.sizeof(v4l2_buffer))
+VIDIOC_QBUF = _ioc(3, 15, ctypes.sizeof(v4l2_buffer))
+VIDIOC_DQBUF = _ioc(3, 17, ctypes.sizeof(v4l2_buffer))
+VIDIOC_STREAMON = _ioc(1, 18, ctypes.sizeof(ctypes.c_int))
+VIDIOC_STREAMOFF = _ioc(1, 19, ctypes.sizeof(ctypes.c_int))
+
+V4L2_BUF_TYPE_VIDEO_CAPTURE = 1
+V4L2_MEMORY_MMAP = 1
+V4L2_CAP_VIDEO_CAPTURE = 0x00000001
+V4L2_BUF_FLAG_ERROR = 0x00000040
+V4L2_BUF_FLAG_TIMESTAMP_MASK = 0x0000e000
+V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC = 0x00002000
+
+
+def fourcc(code):
+    return struct.unpack("<I", code.ljust(4).encode())[0]
+
+
+def set_format(dev, spec):
+    """Switch dev to "FOURCC:WxH"; returns the format the driver chose."""
+    code, _, size = spec.partition(":")
+    width, _, height = size.partition("x")
+    fmt = v4l2_format(type=V4L2_BUF_TYPE_VIDEO_CAPTURE)
+    fmt.fmt.pix.pixelformat = fourcc(code)
+    fmt.fmt.pix.width = int(width)
+    fmt.fmt.pix.height = int(height)
+    fd = os.open(dev, os.O_RDWR)
+    try:
+        fcntl.ioctl(fd, VIDIOC_S_FMT, fmt)
+    finally:
+        os.close(fd)
+    pix = fmt.fmt.pix
+    return "%s:%dx%d" % (struct.pack("<I", pix.pixelformat).decode().strip(), pix.width, pix.height)
+
+
+def uvc_capture_nodes():
+    nodes = []
+    # In numeric order, video2 before video10
+    for dev in sorted(glob.glob("/dev/video*"), key=lambda d: (len(d), d)):
+        try:
+            fd = os.open(dev, os.O_RDWR | os.O_NONBLOCK)
+        except OSError:
+            continue
+        cap = v4l2_capability()
+        try:
+            fcntl.ioctl(fd, VIDIOC_QUERYCAP, cap)
+        except OSError:
+            continue
+        finally:
+            os.close(fd)
+        # RealSense also exposes metadata-only nodes; skip those
+        if cap.driver == b"uvcvideo" and cap.device_caps & V4L2_CAP_VIDEO_CAPTURE:
+            nodes.append((dev, cap.card.decode(errors="replace")))
+    return nodes
+
+
+def uvc_debugfs_stats(dev):
+    """Driver counters of the stream behind dev, from uvcvideo's debugfs."""
+    intf = os.path.realpath("/sys/class/video4linux/%s/device" % os.path.basename(dev))
+    usb = os.path.dirname(intf)
+    try:
+        with open(os.path.join(intf, "bInterfaceNumber")) as f:
+            intfnum = int(f.read(), 16)
+        with open(os.path.join(usb, "busnum")) as f:
+            busnum = int(f.read())
+        with open(os.path.join(usb, "devnum")) as f:
+            devnum = int(f.read())
+    except (OSError, ValueError):
+        return {}
+    path = "/sys/kernel/debug/usb/uvcvideo/%u-%u-%u/stats" % (busnum, devnum, intfnum)
+    stats = {}
+    try:
+        with open(path) as f:
+            for line in f:
+                key, _, value = line.partition(":")
+                if key in ("frames", "packets", "empty", "errors", "invalid"):
+                    stats[key] = int(value.split()[0])
+    except (OSError, ValueError, IndexError):
+        pass
+    return stats
+
+
+def kernel_ticks():
+    """System, IRQ and softirq time of all CPUs, in clock ticks."""
+    with open("/proc/stat") as f:
+        fields = f.readline().split()
+    return int(fields[3]) + int(fields[6]) + int(fields[7])
+
+
+def stream_uvc(dev, duration, nbufs=4):
+    fd = os.open(dev, os.O_RDWR | os.O_NONBLOCK)
+    maps = []
+    try:
+        req = v4l2_requestbuffers(count=nbufs, type=V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                  memory=V4L2_MEMORY_MMAP)
+        fcntl.ioctl(fd, VIDIOC_REQBUFS, req)
+        for i in range(req.count):
+            buf = v4l2_buffer(index=i, type=V4L2_BUF_TYPE_VIDEO_CAPTURE, memory=V4L2_MEMORY_MMAP)
+            fcntl.ioctl(fd, VIDIOC_QUERYBUF, buf)
+            maps.append(mmap.mmap(fd, buf.length, mmap.MAP_SHARED, mmap.PROT_READ,
+                                  offset=buf.m.offset))
+            fcntl.ioctl(fd, VIDIOC_QBUF, buf)
+        ticks = kernel_ticks()
+        fcntl.ioctl(fd, VIDIOC_STREAMON, ctypes.c_int(V4L2_BUF_TYPE_VIDEO_CAPTURE))
+
+        frames = errors = dropped = nbytes = 0
+        latencies = []
+        first = last = None
+        last_seq = None
+        # Longest time without a frame, from STREAMON to the end of the run
+        prev = time.monotonic()
+        gap = 0.0
+        end = prev + duration
+        while time.monotonic() < end:
+            if not select.select([fd], [], [], 1.0)[0]:
+                continue
+            buf = v4l2_buffer(type=V4L2_BUF_TYPE_VIDEO_CAPTURE, memory=V4L2_MEMORY_MMAP)
+            try:
+                fcntl.ioctl(fd, VIDIOC_DQBUF, buf)
+            except OSError as e:
+                if e.errno == errno.EAGAIN:
+                    continue
+                raise
+            now = time.monotonic()
+            gap = max(gap, now - prev)
+            prev = now
+            frames += 1
+            nbytes += buf.bytesused
+            first = first or now
+            last = now
+            if buf.flags & V4L2_BUF_FLAG_ERROR:
+                errors += 1
+            if last_seq is not None and buf.sequence > last_seq + 1:
+                dropped += buf.sequence - last_seq - 1
+            last_seq = buf.sequence
+            if buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:
+                ts = buf.timestamp.tv_sec + buf.timestamp.tv_usec / 1e6
+                latencies.append((now - ts) * 1000.0)
+            fcntl.ioctl(fd, VIDIOC_QBUF, buf)
+        gap = max(gap, time.monotonic() - prev)
+        fcntl.ioctl(fd, VIDIOC_STREAMOFF, ctypes.c_int(V4L2_BUF_TYPE_VIDEO_CAPTURE))
+        ticks = kernel_ticks() - ticks
+    finally:
+        for m in maps:
+            m.close()
+        os.close(fd)
+
+    elapsed = last - first if frames > 1 else 0.0
+    fps = (frames - 1) / elapsed if elapsed > 0 else 0.0
+    latencies.sort()
+    return {
+        "frames": frames,
+        "fps": fps,
+        "mb_s": nbytes / elapsed / 1e6 if elapsed > 0 else 0.0,
+        "errors": errors,
+        "dropped": dropped,
+        "drop_pct": 100.0 * (dropped + errors) / max(frames + dropped, 1),
+        "lat_p50": percentile(latencies, 50),
+        "lat_p99": percentile(latencies, 99),
+        "lat_max": latencies[-1] if latencies else None,
+        "gap_ms": gap * 1000.0,
+        # Includes whatever else the kernel did meanwhile; compare builds
+        # on an otherwise idle system and with a longer --duration
+        "cpu_us": ticks * 1e6 / os.sysconf("SC_CLK_TCK") / frames if frames else None,
+    }
+
+
+# SocketCAN (include/uapi/linux/can.h, can/raw.h)
+CAN_FRAME = struct.Struct("=IB3x8s")
+SOL_CAN_RAW = 101
+CAN_RAW_RECV_OWN_MSGS = 4
+MSG_CONFIRM = 0x800
+
+
+def gs_usb_interfaces():
+    ifaces = []
+    for path in sorted(glob.glob("/sys/class/net/can*")):
+        driver = os.path.realpath(os.path.join(path, "device", "driver"))
+        if os.path.basename(driver) == "gs_usb":
+            ifaces.append(os.path.basename(path))
+    return ifaces
+
+
+def iface_is_up(ifname):
+    with open("/sys/class/net/%s/flags" % ifname) as f:
+        return int(f.read(), 16) & 0x1
+
+
+def ip_link(*args):
+    subprocess.run(["ip", "link", "set"] + list(args), check=True,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def can_burst(ifname, count, timeout=5.0):
+    s = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+    try:
+        s.setsockopt(SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, 1)
+        s.bind((ifname,))
+        s.setblocking(False)
+
+        # Single frames first: TX-to-echo latency without queueing
+        echo_us = []
+        for i in range(min(100, count)):
+            sent = time.monotonic()
+            s.send(CAN_FRAME.pack(0x123, 8, struct.pack("<Q", i)))
+            deadline = sent + 0.1
+            while time.monotonic() < deadline:
+                if not select.select([s], [], [], deadline - time.monotonic())[0]:
+                    break
+                _, _, flags, _ = s.recvmsg(CAN_FRAME.size)
+                if flags & MSG_CONFIRM:
+                    echo_us.append((time.monotonic() - sent) * 1e6)
+                    break
+
+        # Then a burst: frames per second through the adapter and back
+        echoes = rx = sent = 0
+        ticks = kernel_ticks()
+        start = time.monotonic()
+        end = start + timeout
+        while (sent < count or echoes < count) and time.monotonic() < end:
+            if sent < count:
+                try:
+                    s.send(CAN_FRAME.pack(0x124, 8, struct.pack("<Q", sent)))
+                    sent += 1
+                    continue
+                except OSError as e:
+                    if e.errno not in (errno.ENOBUFS, errno.EAGAIN):
+                        raise
+            if select.select([s], [], [], 0.01)[0]:
+                while True:
+                    try:
+                        _, _, flags, _ = s.recvmsg(CAN_FRAME.size)
+                    except BlockingIOError:
+                        break
+                    if flags & MSG_CONFIRM:
+                        echoes += 1
+                    else:
+                        rx += 1
+        elapsed = time.monotonic() - start
+        ticks = kernel_ticks() - ticks
+    finally:
+        s.close()
+
+    echo_us.sort()
+    return {
+        "sent": sent,
+        "echoes": echoes,
+        "rx": rx,
+        "fps": echoes / elapsed if elapsed > 0 else 0.0,
+        "echo_p50": percentile(echo_us, 50),
+        "echo_p99": percentile(echo_us, 99),
+        "echo_max": echo_us[-1] if echo_us else None,
+        "cpu_us": ticks * 1e6 / os.sysconf("SC_CLK_TCK") / echoes if echoes else None,
+    }
+
+
+# IIO buffers of the HID sensor hub (accel_3d, gyro_3d)
+IIO_SENSORS = ("accel_3d", "gyro_3d")
+
+
+def hid_sensor_devices():
+    devs = []
+    for path in sorted(glob.glob("/sys/bus/iio/devices/iio:device*")):
+        try:
+            with open(os.path.join(path, "name")) as f:
+                name = f.read().strip()
+        except OSError:
+            continue
+        if name in IIO_SENSORS and "HID-SENSOR-" in os.path.realpath(path):
+            devs.append((os.path.basename(path), name))
+    return devs
+
+
+def sysfs_write(path, value):
+    with open(path, "w") as f:
+        f.write(str(value))
+
+
+def sysfs_read(path):
+    with open(path) as f:
+        return f.read().strip()
+
+
+def iio_layout(sysdir):
+    """Offsets and struct formats of the enabled scan elements, plus the
+    record size, from scan_elements/*_index and *_type."""
+    chans = []
+    for en in glob.glob(os.path.join(sysdir, "scan_elements", "*_en")):
+        if sysfs_read(en) != "1":
+            continue
+        base = en[:-3]
+        index = int(sysfs_read(base + "_index"))
+        # e.g. "le:s32/32>>0"
+        endian, rest = sysfs_read(base + "_type").split(":")
+        sign, bits = rest[0], rest[1:].split("/")[1].split(">>")[0]
+        size = int(bits) // 8
+        code = {1: "b", 2: "h", 4: "i", 8: "q"}[size]
+        chans.append((index, os.path.basename(base), size,
+                      ("<" if endian == "le" else ">") + (code if sign == "s" else code.upper())))
+    chans.sort()
+    layout, offset, align = {}, 0, 1
+    for _, name, size, fmt in chans:
+        offset = (offset + size - 1) // size * size
+        layout[name] = (offset, fmt)
+        offset += size
+        align = max(align, size)
+    return layout, (offset + align - 1) // align * align
+
+
+def stream_iio(dev, duration):
+    sysdir = "/sys/bus/iio/devices/" + dev
+    elements = glob.glob(os.path.join(sysdir, "scan_elements", "*_en"))
+    saved = {en: sysfs_read(en) for en in elements}
+    clock = os.path.join(sysdir, "current_timestamp_clock")
+    saved_clock = sysfs_read(clock) if os.path.exists(clock) else None
+    length = os.path.join(sysdir, "buffer", "length")
+    saved_length = sysfs_read(length)
+    fd = None
+    try:
+        for en in elements:
+            sysfs_write(en, 1)
+        # Buffer timestamps in the clock that time.monotonic() reads, and
+        # room for a few hundred milliseconds of samples at kHz rates
+        if saved_clock is not None:
+            sysfs_write(clock, "monotonic")
+        if int(saved_length) < 1024:
+            sysfs_write(length, 1024)
+        layout, record = iio_layout(sysdir)
+        if "in_timestamp" not in layout:
+            raise OSError(errno.ENOTSUP, "no timestamp channel")
+        ts_offset, ts_fmt = layout["in_timestamp"]
+
+        ticks = kernel_ticks()
+        sysfs_write(os.path.join(sysdir, "buffer", "enable"), 1)
+        fd = os.open("/dev/" + dev, os.O_RDONLY | os.O_NONBLOCK)
+        stamps, latencies = [], []
+        pending = b""
+        prev = time.monotonic_ns()
+        gap = 0
+        end = time.monotonic() + duration
+        while time.monotonic() < end:
+            if not select.select([fd], [], [], 0.5)[0]:
+                continue
+            try:
+                pending += os.read(fd, record * 256)
+            except BlockingIOError:
+                continue
+            now = time.monotonic_ns()
+            gap = max(gap, now - prev)
+            prev = now
+            while len(pending) >= record:
+                ts = struct.unpack_from(ts_fmt, pending, ts_offset)[0]
+                stamps.append(ts)
+                latencies.append((now - ts) / 1e6)
+                pending = pending[record:]
+        gap = max(gap, time.monotonic_ns() - prev)
+        sysfs_write(os.path.join(sysdir, "buffer", "enable"), 0)
+        ticks = kernel_ticks() - ticks
+    finally:
+        if fd is not None:
+            os.close(fd)
+        try:
+            sysfs_write(os.path.join(sysdir, "buffer", "enable"), 0)
+            for en, value in saved.items():
+                sysfs_write(en, value)
+            sysfs_write(length, saved_length)
+            if saved_clock is not None:
+                sysfs_write(clock, saved_clock)
+        except OSError:
+            pass
+
+    # Lost samples from gaps in the timestamps: the median interval is
+    # the sampling period
+    intervals = sorted(b - a for a, b in zip(stamps, stamps[1:]))
+    period = intervals[len(intervals) // 2] if intervals else 0
+    lost = 0
+    if period > 0:
+        for a, b in zip(stamps, stamps[1:]):
+            if b - a > 1.5 * period:
+                lost += round((b - a) / period) - 1
+    elapsed = (stamps[-1] - stamps[0]) / 1e9 if len(stamps) > 1 else 0.0
+    latencies.sort()
+    lat_p50 = percentile(latencies, 50)
+    # Device timestamps in the camera's own clock say nothing about delivery
+    if lat_p50 is not None and not 0 <= lat_p50 < 1000:
+        lat_p50 = None
+    return {
+        "samples": len(stamps),
+        "rate": (len(stamps) - 1) / elapsed if elapsed > 0 else 0.0,
+        "lost": lost,
+        "loss_pct": 100.0 * lost / max(len(stamps) + lost, 1),
+        "lat_p50": lat_p50,
+        "lat_p99": percentile(latencies, 99) if lat_p50 is not None else None,
+        "lat_max": latencies[-1] if lat_p50 is not None else None,
+        "gap_ms": gap / 1e6,
+        "cpu_us": ticks * 1e6 / os.sysconf("SC_CLK_TCK") / len(stamps) if stamps else None,
+    }
+
+
+class StreamAction(argparse.Action):
+    """--device adds a [device, format] pair, --format sets the format of the
+    last one"""
+
+    def __call__(self, parser, namespace, value, option_string=None):
+        streams = list(getattr(namespace, self.dest))
+        setattr(namespace, self.dest, streams)
+        if option_string == "--device":
+            streams.append([value, None])
+        elif not streams:
+            parser.error("--format needs a --device before it")
+        elif streams[-1][1]:
+            parser.error("more than one --format for %s" % streams[-1][0])
+        else:
+            streams[-1] = [streams[-1][0], value]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Camera and CAN self-test")
+    parser.add_argument("--profile", default="/etc/jetson-modules/tuning.profile")
+    parser.add_argument("--duration", type=float)
+    parser.add_argument("--device", dest="streams", action=StreamAction, default=[], metavar="DEVICE")
+    parser.add_argument("--format", dest="streams", action=StreamAction, metavar="FOURCC:WxH")
+    parser.add_argument("--can", action="append", default=[])
+    parser.add_argument("--iio", action="append", default=[])
+    parser.add_argument("--json")
+    args = parser.parse_args()
+
+    limits = read_thresholds(args.profile)
+    if args.duration:
+        limits["duration"] = args.duration
+    failures = 0
+    results = []
+
+    def check(ok, text):
+        nonlocal failures
+        print("  %-5s %s" % ("ok" if ok else "FAIL", text))
+        failures += 0 if ok else 1
+
+    selected = args.streams or args.can or args.iio
+    cards = dict(uvc_capture_nodes()) if args.streams or not selected else {}
+    if args.streams:
+        missing = [dev for dev, _ in args.streams if dev not in cards]
+        if missing:
+            print("Not a uvcvideo capture device: " + " ".join(missing))
+            return 1
+        streams = [(dev, cards[dev], fmt) for dev, fmt in args.streams]
+    else:
+        streams = [(dev, card, None) for dev, card in cards.items()]
+    if not streams and not selected:
+        print("No uvcvideo capture devices found")
+    for dev, card, fmt in streams:
+        if fmt:
+            try:
+                card += ", " + set_format(dev, fmt)
+            except (OSError, ValueError) as e:
+                check(False, "%s: cannot set format %s: %s" % (dev, fmt, e))
+                continue
+        print("Streaming %s (%s) for %.0f s..." % (dev, card, limits["duration"]))
+        try:
+            r = stream_uvc(dev, limits["duration"])
+        except OSError as e:
+            check(False, "%s: streaming failed: %s" % (dev, e.strerror))
+            continue
+        stats = uvc_debugfs_stats(dev)
+        results.append(dict(r, kind="uvc", device=dev, driver=stats))
+        check(r["fps"] >= limits["uvc-min-fps"],
+              "%s: %.2f fps (min %.2f), %d frames" % (dev, r["fps"], limits["uvc-min-fps"], r["frames"]))
+        check(r["drop_pct"] <= limits["uvc-max-drop-pct"],
+              "%s: %d dropped, %d error frames = %.2f%% (max %.2f%%)"
+              % (dev, r["dropped"], r["errors"], r["drop_pct"], limits["uvc-max-drop-pct"]))
+        if r["lat_p50"] is not None:
+            check(r["lat_p50"] <= limits["uvc-max-latency-ms"],
+                  "%s: dequeue latency p50 %.2f ms, p99 %.2f ms, max %.2f ms (max p50 %.2f ms)"
+                  % (dev, r["lat_p50"], r["lat_p99"], r["lat_max"], limits["uvc-max-latency-ms"]))
+        print("        %.1f MB/s delivered, longest gap %.0f ms" % (r["mb_s"], r["gap_ms"]))
+        if r["cpu_us"] is not None:
+            print("        kernel CPU: %.0f us per frame" % r["cpu_us"])
+        if stats:
+            print("        driver: " + ", ".join("%s %d" % kv for kv in sorted(stats.items())))
+
+    ifaces = gs_usb_interfaces() if args.can or not selected else []
+    if args.can:
+        if set(args.can) - set(ifaces):
+            print("Not a gs_usb interface: " + " ".join(set(args.can) - set(ifaces)))
+            return 1
+        ifaces = args.can
+    if not ifaces and not selected:
+        print("No gs_usb CAN interfaces found")
+    for ifname in ifaces:
+        if iface_is_up(ifname):
+            print("Skipping %s: interface is up and may be in use" % ifname)
+            continue
+        print("Testing %s in loopback mode at %d bit/s..." % (ifname, limits["can-bitrate"]))
+        try:
+            ip_link(ifname, "type", "can", "bitrate", str(limits["can-bitrate"]), "loopback", "on")
+            ip_link(ifname, "up")
+            # Long enough for a burst that lasts the whole --duration
+            r = can_burst(ifname, limits["can-frames"], max(5.0, 2 * limits["duration"]))
+        except (OSError, subprocess.CalledProcessError) as e:
+            check(False, "%s: test failed: %s" % (ifname, e))
+            continue
+        finally:
+            subprocess.run(["ip", "link", "set", ifname, "down"], stderr=subprocess.DEVNULL)
+            subprocess.run(["ip", "link", "set", ifname, "type", "can", "loopback", "off"],
+                           stderr=subprocess.DEVNULL)
+        results.append(dict(r, kind="can", device=ifname))
+        check(r["echoes"] == r["sent"] and r["fps"] >= limits["can-min-fps"],
+              "%s: %d/%d echoed, %.0f frames/s (min %.0f), %d looped back"
+              % (ifname, r["echoes"], r["sent"], r["fps"], limits["can-min-fps"], r["rx"]))
+        if r["echo_p50"] is not None:
+            check(r["echo_p50"] <= limits["can-max-echo-us"],
+                  "%s: echo latency p50 %.0f us, p99 %.0f us, max %.0f us (max p50 %.0f us)"
+                  % (ifname, r["echo_p50"], r["echo_p99"], r["echo_max"], limits["can-max-echo-us"]))
+        else:
+            check(False, "%s: no echo received" % ifname)
+        if r["cpu_us"] is not None:
+            print("        kernel CPU: %.1f us per frame" % r["cpu_us"])
+
+    sensors = hid_sensor_devices() if args.iio or not selected else []
+    if args.iio:
+        if set(args.iio) - set(dev for dev, _ in sensors):
+            print("Not a HID sensor IIO device: " +
+                  " ".join(set(args.iio) - set(dev for dev, _ in sensors)))
+            return 1
+        sensors = [(dev, name) for dev, name in sensors if dev in args.iio]
+    if not sensors and not selected:
+        print("No HID sensor IIO devices found")
+    for dev, name in sensors:
+        if sysfs_read("/sys/bus/iio/devices/%s/buffer/enable" % dev) == "1":
+            print("Skipping %s: buffer is enabled and may be in use" % dev)
+            continue
+        print("Reading %s (%s) for %.0f s..." % (dev, name, limits["duration"]))
+        try:
+            r = stream_iio(dev, limits["duration"])
+        except (OSError, ValueError) as e:
+            check(False, "%s: reading failed: %s" % (dev, e))
+            continue
+        results.append(dict(r, kind="iio", device=dev, name=name))
+        check(r["samples"] > 0 and r["loss_pct"] <= limits["imu-max-loss-pct"],
+              "%s: %d samples at %.1f/s, %d lost = %.2f%% (max %.2f%%)"
+              % (dev, r["samples"], r["rate"], r["lost"], r["loss_pct"], limits["imu-max-loss-pct"]))
+        if r["lat_p50"] is not None:
+            check(r["lat_p50"] <= limits["imu-max-latency-ms"],
+                  "%s: delivery latency p50 %.2f ms, p99 %.2f ms, max %.2f ms (max p50 %.2f ms)"
+                  % (dev, r["lat_p50"], r["lat_p99"], r["lat_max"], limits["imu-max-latency-ms"]))
+        print("        longest gap %.0f ms" % r["gap_ms"])
+        if r["cpu_us"] is not None:
+            print("        kernel CPU: %.1f us per sample" % r["cpu_us"])
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=1)
+    print("Self-test: %d failure(s)" % failures)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
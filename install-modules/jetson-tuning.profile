@@ -0,0 +1,45 @@
+# Performance profile for RealSense cameras and CAN adapters on Jetson Orin
+#
+# Applied by install-jetson-modules.sh --tune and checked by
+# --verify-tuning. One setting per line:
+#
+#   param         <module>.<parameter>  <value>
+#   usb-power     <vendor>:<product>    <on|auto>    (product may be *)
+#   irq-affinity  <irq name pattern>    <cpu list>
+#   selftest      <threshold>           <value>
+#
+# Parameters of loadable modules go to /etc/modprobe.d, parameters of
+# built-in ones (usbcore on the Tegra kernel) to /etc/tmpfiles.d, and USB
+# power settings to a udev rule. All of them are also applied at once.
+
+# usbfs buffers: the 16 MB default is too small for several D4xx streams
+param         usbcore.usbfs_memory_mb   1000
+
+# Deliver incomplete frames instead of dropping them, and let the driver
+# use the camera's own timestamps
+param         uvcvideo.nodrop           1
+param         uvcvideo.hwtimestamps     1
+# Forced quirks are not needed for D4xx cameras; uncomment to override
+#param        uvcvideo.quirks           0
+
+# No autosuspend for RealSense cameras and candleLight CAN adapters
+usb-power     8086:*                    on
+usb-power     1d50:606f                 on
+
+# Keep xHCI interrupts off CPU0, which handles most other interrupts
+irq-affinity  xhci                      1
+
+# Thresholds for install-jetson-modules.sh --self-test. Each camera
+# streams in its current format for <duration> seconds; each idle gs_usb
+# interface sends <can-frames> frames in loopback mode; each IMU sensor
+# is read at its current sampling frequency for <duration> seconds
+selftest      duration                  3
+selftest      uvc-min-fps               25
+selftest      uvc-max-drop-pct          1
+selftest      uvc-max-latency-ms        50
+selftest      can-bitrate               1000000
+selftest      can-frames                2000
+selftest      can-min-fps               1000
+selftest      can-max-echo-us           2000
+selftest      imu-max-loss-pct          1
+selftest      imu-max-latency-ms        20
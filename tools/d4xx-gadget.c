@@ -0,0 +1,686 @@
+/*
+ * Emulated RealSense D4xx UVC camera for benchmarking uvcvideo
+ *
+ * Runs a USB device through raw-gadget on a UDC, normally dummy_hcd so
+ * that the host side is the same machine. The device has the D435 IDs,
+ * so uvcvideo applies its D4xx handling and creates the metadata node,
+ * and one bulk video streaming interface with the D4xx formats Z16, Y8I,
+ * Y12I and YUYV. dummy_hcd fails all isochronous transfers, hence bulk.
+ *
+ * Frames are sent at the negotiated rate with PTS and SCR in every
+ * payload header. The header of each frame's first payload also carries
+ * a capture-timing block modelled on the D4xx metadata, which uvcvideo
+ * passes through to the metadata node.
+ *
+ * -f injects faults into the stream, each into a given fraction of the
+ * payloads, while SIGUSR2 has toggled injection on: "short" sends half
+ * of the payload data, "header" an invalid header length, "overflow"
+ * more data than the host's URB holds (babble) and "stall" halts the
+ * endpoint for 10 ms instead of sending the payload. The number of
+ * faults injected is printed whenever injection is toggled. After a
+ * disconnect the camera waits for the host to commit a format again.
+ *
+ * Usage: d4xx-gadget [-s high|super] [-W width] [-H height] [-r fps]
+ *                    [-f fault:fraction]... [-u udc-driver] [-d udc-device]
+ *
+ * Built on demand by uvc-bench.sh; needs the raw_gadget module and the
+ * <linux/usb/raw_gadget.h> header of Linux 5.10 or later, the first
+ * with the endpoint halt ioctls.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+#include <linux/usb/video.h>
+
+#define EP_ADDR         0x81
+#define MAX_PACKETS     32      /* UVC_MAX_PACKETS in uvcvideo */
+#define CLOCK_HZ        48000000
+#define STREAM_INTF     1
+#define STALL_US        10000
+
+struct format {
+	const char *name;
+	uint8_t guid[16];
+	uint8_t bpp;
+};
+
+/* FourCC followed by the standard UVC GUID suffix, as uvcvideo expects */
+#define GUID(a, b, c, d) { a, b, c, d, 0x00, 0x00, 0x10, 0x00, \
+			   0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 }
+
+static const struct format formats[] = {
+	{ "Z16",  GUID('Z', '1', '6', ' '), 16 },
+	{ "Y8I",  GUID('Y', '8', 'I', ' '), 16 },
+	{ "Y12I", GUID('Y', '1', '2', 'I'), 24 },
+	{ "YUYV", GUID('Y', 'U', 'Y', '2'), 16 },
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+/* Capture-timing block after the standard 12 header bytes */
+struct md_capture_timing {
+	uint32_t id;
+	uint32_t size;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t frame_counter;
+	uint32_t optical_timestamp;
+	uint32_t readout_time;
+	uint32_t exposure_time;
+	uint32_t frame_interval;
+	uint32_t pipe_latency;
+} __attribute__((packed));
+
+#define MD_CAPTURE_TIMING_ID 0x80000001
+
+static int fd;
+static int super_speed;
+static unsigned int width = 848, height = 480, fps = 30;
+static unsigned int max_packet, payload_size;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t committed = PTHREAD_COND_INITIALIZER;
+static struct uvc_streaming_control probe, commit;
+static int have_commit, ep_handle = -1;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+/* Fault injection */
+
+enum { FAULT_SHORT, FAULT_HEADER, FAULT_OVERFLOW, FAULT_STALL, NUM_FAULTS };
+
+static const char *const fault_names[NUM_FAULTS] = { "short", "header", "overflow", "stall" };
+static double fault_fraction[NUM_FAULTS];
+static unsigned long fault_count[NUM_FAULTS];
+static unsigned short fault_seed[3];
+static pthread_mutex_t fault_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t faults_on;
+
+static int parse_fault(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	char *end;
+	int i;
+
+	for (i = 0; colon && i < NUM_FAULTS; i++) {
+		if (strlen(fault_names[i]) != (size_t)(colon - spec) ||
+		    strncmp(spec, fault_names[i], colon - spec))
+			continue;
+		fault_fraction[i] = strtod(colon + 1, &end);
+		return *end == 0 && fault_fraction[i] >= 0 && fault_fraction[i] <= 1;
+	}
+	return 0;
+}
+
+/* Whether to inject the fault now */
+static int inject(int fault)
+{
+	int hit;
+
+	if (!faults_on || !fault_fraction[fault])
+		return 0;
+	pthread_mutex_lock(&fault_lock);
+	hit = erand48(fault_seed) < fault_fraction[fault];
+	fault_count[fault] += hit;
+	pthread_mutex_unlock(&fault_lock);
+	return hit;
+}
+
+static void toggle_faults(int sig)
+{
+	(void)sig;
+	faults_on = !faults_on;
+}
+
+static void report_faults(void)
+{
+	int i;
+
+	pthread_mutex_lock(&fault_lock);
+	fprintf(stderr, "d4xx-gadget: fault injection %s, injected so far:", faults_on ? "on" : "off");
+	for (i = 0; i < NUM_FAULTS; i++)
+		fprintf(stderr, " %s %lu", fault_names[i], fault_count[i]);
+	fprintf(stderr, "\n");
+	pthread_mutex_unlock(&fault_lock);
+}
+
+/* Descriptor building */
+
+static uint8_t config[1024];
+static size_t config_len;
+
+static uint8_t *put(const void *data, size_t len)
+{
+	uint8_t *p = config + config_len;
+
+	memcpy(p, data, len);
+	config_len += len;
+	return p;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static uint32_t frame_size(const struct format *f)
+{
+	return width * height * f->bpp / 8;
+}
+
+static void build_config(void)
+{
+	uint32_t interval = 10000000 / fps;
+	uint8_t *vc, *vs, *p;
+	size_t vc_start, vs_start;
+	unsigned int i;
+
+	put((uint8_t []){ 9, USB_DT_CONFIG, 0, 0, 2, 1, 0, 0x80, 250 }, 9);
+	put((uint8_t []){ 8, USB_DT_INTERFACE_ASSOCIATION, 0, 2, USB_CLASS_VIDEO,
+			  UVC_SC_VIDEO_INTERFACE_COLLECTION, 0, 2 }, 8);
+
+	put((uint8_t []){ 9, USB_DT_INTERFACE, 0, 0, 0, USB_CLASS_VIDEO,
+			  UVC_SC_VIDEOCONTROL, 0, 2 }, 9);
+	vc_start = config_len;
+	vc = put((uint8_t []){ 13, USB_DT_CS_INTERFACE, UVC_VC_HEADER, 0x10, 0x01,
+			       0, 0, 0, 0, 0, 0, 1, STREAM_INTF }, 13);
+	put32(vc + 7, CLOCK_HZ);
+	put((uint8_t []){ 18, USB_DT_CS_INTERFACE, UVC_VC_INPUT_TERMINAL, 1,
+			  UVC_ITT_CAMERA & 0xff, UVC_ITT_CAMERA >> 8, 0, 0,
+			  0, 0, 0, 0, 0, 0, 3, 0, 0, 0 }, 18);
+	put((uint8_t []){ 9, USB_DT_CS_INTERFACE, UVC_VC_OUTPUT_TERMINAL, 2,
+			  UVC_TT_STREAMING & 0xff, UVC_TT_STREAMING >> 8, 0, 1, 0 }, 9);
+	put16(vc + 5, config_len - vc_start);
+
+	/* A single alternate setting with a bulk endpoint */
+	put((uint8_t []){ 9, USB_DT_INTERFACE, STREAM_INTF, 0, 1, USB_CLASS_VIDEO,
+			  UVC_SC_VIDEOSTREAMING, 0, 0 }, 9);
+	vs_start = config_len;
+	vs = put((uint8_t []){ 13 + NUM_FORMATS, USB_DT_CS_INTERFACE, UVC_VS_INPUT_HEADER,
+			       NUM_FORMATS, 0, 0, EP_ADDR, 0, 2, 0, 0, 0, 1 }, 13);
+	for (i = 0; i < NUM_FORMATS; i++)
+		put((uint8_t []){ 0 }, 1);
+	for (i = 0; i < NUM_FORMATS; i++) {
+		const struct format *f = &formats[i];
+
+		put((uint8_t []){ 27, USB_DT_CS_INTERFACE, UVC_VS_FORMAT_UNCOMPRESSED,
+				      i + 1, 1 }, 5);
+		put(f->guid, 16);
+		put((uint8_t []){ f->bpp, 1, 0, 0, 0, 0 }, 6);
+
+		p = put((uint8_t []){ 30, USB_DT_CS_INTERFACE, UVC_VS_FRAME_UNCOMPRESSED,
+				      1, 0 }, 5);
+		put((uint8_t [25]){ 0 }, 25);
+		put16(p + 5, width);
+		put16(p + 7, height);
+		put32(p + 9, frame_size(f) * 8 * fps);
+		put32(p + 13, frame_size(f) * 8 * fps);
+		put32(p + 17, frame_size(f));
+		put32(p + 21, interval);
+		p[25] = 1;
+		put32(p + 26, interval);
+	}
+	put16(vs + 4, config_len - vs_start);
+
+	p = put((uint8_t []){ 7, USB_DT_ENDPOINT, EP_ADDR, USB_ENDPOINT_XFER_BULK, 0, 0, 0 }, 7);
+	put16(p + 4, max_packet);
+	if (super_speed)
+		put((uint8_t []){ 6, USB_DT_SS_ENDPOINT_COMP, 15, 0, 0, 0 }, 6);
+
+	put16(config + 2, config_len);
+}
+
+static const uint8_t bos[] = {
+	5, USB_DT_BOS, 22, 0, 2,
+	7, USB_DT_DEVICE_CAPABILITY, USB_CAP_TYPE_EXT, 0x02, 0, 0, 0,
+	10, USB_DT_DEVICE_CAPABILITY, USB_SS_CAP_TYPE, 0, 0x0e, 0, 1, 10, 0, 1,
+};
+
+static const char *strings[] = {
+	NULL,
+	"Intel(R) Corporation",
+	"Intel(R) RealSense(TM) Depth Camera 435 (emulated)",
+	"EMUL00000001",
+};
+
+/* Fill in the fields the device decides for a probe or commit request */
+static void fix_control(struct uvc_streaming_control *ctrl)
+{
+	if (ctrl->bFormatIndex < 1 || ctrl->bFormatIndex > NUM_FORMATS)
+		ctrl->bFormatIndex = 1;
+	ctrl->bFrameIndex = 1;
+	ctrl->dwFrameInterval = 10000000 / fps;
+	ctrl->dwMaxVideoFrameSize = frame_size(&formats[ctrl->bFormatIndex - 1]);
+	ctrl->dwMaxPayloadTransferSize = payload_size;
+	ctrl->dwClockFrequency = CLOCK_HZ;
+	ctrl->bmFramingInfo = 3;
+}
+
+/* Control transfers */
+
+struct ep0_io {
+	struct usb_raw_ep_io io;
+	uint8_t data[1024];
+};
+
+static void ep0_write(const void *data, size_t len, uint16_t wLength)
+{
+	struct ep0_io r = { .io.length = len < wLength ? len : wLength };
+
+	memcpy(r.data, data, r.io.length);
+	if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &r) < 0)
+		perror("ep0 write");
+}
+
+static int ep0_read(void *data, size_t size, uint16_t wLength)
+{
+	struct ep0_io r = { .io.length = wLength < sizeof(r.data) ? wLength : sizeof(r.data) };
+	int ret = ioctl(fd, USB_RAW_IOCTL_EP0_READ, &r);
+
+	if (ret < 0)
+		perror("ep0 read");
+	else if (data)
+		memcpy(data, r.data, (size_t)ret < size ? (size_t)ret : size);
+	return ret;
+}
+
+static void ep0_stall(void)
+{
+	ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0);
+}
+
+static void get_descriptor(const struct usb_ctrlrequest *req)
+{
+	struct usb_device_descriptor dev = {
+		.bLength = USB_DT_DEVICE_SIZE,
+		.bDescriptorType = USB_DT_DEVICE,
+		.bcdUSB = super_speed ? 0x0320 : 0x0200,
+		.bDeviceClass = USB_CLASS_MISC,
+		.bDeviceSubClass = 0x02,
+		.bDeviceProtocol = 0x01,
+		.bMaxPacketSize0 = super_speed ? 9 : 64,
+		.idVendor = 0x8086,
+		.idProduct = 0x0b07,
+		.bcdDevice = 0x5010,
+		.iManufacturer = 1,
+		.iProduct = 2,
+		.iSerialNumber = 3,
+		.bNumConfigurations = 1,
+	};
+	uint8_t buf[256];
+	unsigned int index = req->wValue & 0xff, i;
+
+	switch (req->wValue >> 8) {
+	case USB_DT_DEVICE:
+		ep0_write(&dev, sizeof(dev), req->wLength);
+		return;
+	case USB_DT_CONFIG:
+		ep0_write(config, config_len, req->wLength);
+		return;
+	case USB_DT_BOS:
+		if (!super_speed)
+			break;
+		ep0_write(bos, sizeof(bos), req->wLength);
+		return;
+	case USB_DT_STRING:
+		if (index == 0) {
+			ep0_write((uint8_t []){ 4, USB_DT_STRING, 0x09, 0x04 }, 4, req->wLength);
+			return;
+		}
+		if (index >= sizeof(strings) / sizeof(strings[0]))
+			break;
+		buf[0] = 2;
+		buf[1] = USB_DT_STRING;
+		for (i = 0; strings[index][i] && buf[0] < sizeof(buf) - 1; i++) {
+			buf[buf[0]++] = strings[index][i];
+			buf[buf[0]++] = 0;
+		}
+		ep0_write(buf, buf[0], req->wLength);
+		return;
+	}
+	ep0_stall();
+}
+
+static void set_configuration(void)
+{
+	struct usb_endpoint_descriptor ep = {
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_ADDR,
+		.bmAttributes = USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize = max_packet,
+	};
+
+	pthread_mutex_lock(&lock);
+	if (ep_handle < 0) {
+		ep_handle = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &ep);
+		if (ep_handle < 0)
+			die("enable streaming endpoint");
+	}
+	pthread_mutex_unlock(&lock);
+	ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, 250);
+	if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+		die("configure");
+	ep0_read(NULL, 0, 0);
+}
+
+static void class_request(const struct usb_ctrlrequest *req)
+{
+	struct uvc_streaming_control ctrl;
+	unsigned int cs = req->wValue >> 8;
+
+	if ((req->wIndex & 0xff) != STREAM_INTF ||
+	    (cs != UVC_VS_PROBE_CONTROL && cs != UVC_VS_COMMIT_CONTROL)) {
+		ep0_stall();
+		return;
+	}
+
+	switch (req->bRequest) {
+	case UVC_SET_CUR:
+		memset(&ctrl, 0, sizeof(ctrl));
+		if (ep0_read(&ctrl, sizeof(ctrl), req->wLength) < 0)
+			return;
+		fix_control(&ctrl);
+		pthread_mutex_lock(&lock);
+		probe = ctrl;
+		if (cs == UVC_VS_COMMIT_CONTROL) {
+			commit = ctrl;
+			have_commit = 1;
+			pthread_cond_signal(&committed);
+		}
+		pthread_mutex_unlock(&lock);
+		return;
+	case UVC_GET_CUR:
+	case UVC_GET_MIN:
+	case UVC_GET_MAX:
+	case UVC_GET_DEF:
+		pthread_mutex_lock(&lock);
+		ctrl = cs == UVC_VS_COMMIT_CONTROL ? commit : probe;
+		pthread_mutex_unlock(&lock);
+		if (req->bRequest == UVC_GET_DEF)
+			ctrl.bFormatIndex = 1;
+		fix_control(&ctrl);
+		ep0_write(&ctrl, sizeof(ctrl), req->wLength);
+		return;
+	case UVC_GET_LEN:
+		ep0_write((uint16_t []){ sizeof(ctrl) }, 2, req->wLength);
+		return;
+	case UVC_GET_INFO:
+		ep0_write((uint8_t []){ 0x03 }, 1, req->wLength);
+		return;
+	}
+	ep0_stall();
+}
+
+static void control(const struct usb_ctrlrequest *req)
+{
+	if ((req->bRequestType & USB_TYPE_MASK) == USB_TYPE_CLASS) {
+		class_request(req);
+		return;
+	}
+	if ((req->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD) {
+		ep0_stall();
+		return;
+	}
+
+	switch (req->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		get_descriptor(req);
+		break;
+	case USB_REQ_SET_CONFIGURATION:
+		set_configuration();
+		break;
+	case USB_REQ_GET_CONFIGURATION:
+		ep0_write((uint8_t []){ 1 }, 1, req->wLength);
+		break;
+	case USB_REQ_SET_INTERFACE:
+		ep0_read(NULL, 0, 0);
+		break;
+	case USB_REQ_GET_INTERFACE:
+		ep0_write((uint8_t []){ 0 }, 1, req->wLength);
+		break;
+	default:
+		ep0_stall();
+	}
+}
+
+/* Streaming */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Standard 12-byte header: PTS and SCR from a 48 MHz clock derived from
+ * CLOCK_MONOTONIC, with a millisecond counter standing in for the SOF */
+static size_t payload_header(uint8_t *p, int fid, int eof, uint32_t pts,
+			     const struct md_capture_timing *md)
+{
+	uint64_t ns = now_ns();
+	size_t len = 12 + (md ? sizeof(*md) : 0);
+
+	p[0] = len;
+	p[1] = UVC_STREAM_EOH | UVC_STREAM_SCR | UVC_STREAM_PTS |
+	       (eof ? UVC_STREAM_EOF : 0) | fid;
+	put32(p + 2, pts);
+	put32(p + 6, ns * (CLOCK_HZ / 1000000) / 1000);
+	put16(p + 10, (ns / 1000000) & 0x7ff);
+	if (md)
+		memcpy(p + 12, md, sizeof(*md));
+	return len;
+}
+
+static void *stream(void *arg)
+{
+	struct usb_raw_ep_io *io = malloc(sizeof(*io) + payload_size + max_packet);
+	uint8_t *image = malloc(frame_size(&formats[2]));
+	struct md_capture_timing md = {
+		.id = MD_CAPTURE_TIMING_ID,
+		.size = sizeof(md),
+		.version = 1,
+		.flags = 0x3f,
+	};
+	uint64_t next = 0, interval = 1000000000ull / fps;
+	uint32_t counter = 0, i;
+	int fid = 0, handle;
+
+	(void)arg;
+	if (!io || !image)
+		die("malloc");
+	/* A gradient that compresses nothing and changes nothing per frame */
+	for (i = 0; i < frame_size(&formats[2]); i++)
+		image[i] = i * 7 + i / width;
+
+	for (;;) {
+		struct timespec ts;
+		uint32_t size, offset = 0, pts;
+
+		pthread_mutex_lock(&lock);
+		while (!have_commit) {
+			pthread_cond_wait(&committed, &lock);
+			next = 0;
+		}
+		size = commit.dwMaxVideoFrameSize;
+		handle = ep_handle;
+		pthread_mutex_unlock(&lock);
+
+		/* Pace frames; after a stall (host not reading) start over */
+		if (next == 0 || now_ns() > next + interval)
+			next = now_ns();
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		next += interval;
+
+		pts = now_ns() * (CLOCK_HZ / 1000000) / 1000;
+		md.frame_counter = ++counter;
+		md.optical_timestamp = now_ns() / 1000;
+		md.exposure_time = interval / 2000;
+		md.frame_interval = interval / 1000;
+
+		while (offset < size) {
+			size_t hlen = payload_header(io->data, fid, 0, pts, offset ? NULL : &md);
+			uint32_t chunk = size - offset;
+
+			if (chunk > payload_size - hlen)
+				chunk = payload_size - hlen;
+			/* A short last payload that is a multiple of the packet
+			 * size would not end the host's URB; hold back a byte */
+			if (chunk == size - offset && hlen + chunk < payload_size &&
+			    (hlen + chunk) % max_packet == 0)
+				chunk--;
+			if (offset + chunk == size)
+				io->data[1] |= UVC_STREAM_EOF;
+			memcpy(io->data + hlen, image + offset, chunk);
+			io->ep = handle;
+			io->flags = 0;
+			io->length = hlen + chunk;
+			offset += chunk;
+
+			if (inject(FAULT_STALL)) {
+				ioctl(fd, USB_RAW_IOCTL_EP_SET_HALT, handle);
+				usleep(STALL_US);
+				ioctl(fd, USB_RAW_IOCTL_EP_CLEAR_HALT, handle);
+				continue;
+			}
+			if (inject(FAULT_SHORT))
+				io->length = hlen + chunk / 2;
+			if (inject(FAULT_HEADER))
+				io->data[0] = 1;
+			if (inject(FAULT_OVERFLOW)) {
+				memset(io->data + io->length, 0, payload_size + max_packet - io->length);
+				io->length = payload_size + max_packet;
+			}
+			if (ioctl(fd, USB_RAW_IOCTL_EP_WRITE, io) < 0) {
+				if (errno == ESHUTDOWN || errno == ENODEV) {
+					/* Disconnected: wait for the next commit */
+					pthread_mutex_lock(&lock);
+					have_commit = 0;
+					pthread_mutex_unlock(&lock);
+					break;
+				}
+				if (errno != EOVERFLOW && errno != EPIPE)
+					perror("ep write");
+			}
+		}
+		fid ^= UVC_STREAM_FID;
+	}
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s high|super] [-W width] [-H height] [-r fps] "
+		"[-f fault:fraction]... [-u udc-driver] [-d udc-device]\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct usb_raw_init init = { .speed = USB_SPEED_HIGH };
+	const char *driver = "dummy_udc", *device = "dummy_udc.0";
+	struct {
+		struct usb_raw_event event;
+		struct usb_ctrlrequest req;
+	} ev;
+	struct sigaction sa = { .sa_handler = toggle_faults };
+	sigset_t usr2;
+	pthread_t thread;
+	int opt, started = 0;
+
+	while ((opt = getopt(argc, argv, "s:W:H:r:f:u:d:")) != -1) {
+		switch (opt) {
+		case 's':
+			super_speed = !strcmp(optarg, "super");
+			if (!super_speed && strcmp(optarg, "high"))
+				usage(argv[0]);
+			break;
+		case 'W': width = atoi(optarg); break;
+		case 'H': height = atoi(optarg); break;
+		case 'r': fps = atoi(optarg); break;
+		case 'f':
+			if (!parse_fault(optarg))
+				usage(argv[0]);
+			break;
+		case 'u': driver = optarg; break;
+		case 'd': device = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!width || !height || !fps || width > 4096 || height > 4096)
+		usage(argv[0]);
+
+	max_packet = super_speed ? 1024 : 512;
+	payload_size = MAX_PACKETS * max_packet;
+	build_config();
+	probe.bFormatIndex = 1;
+	fix_control(&probe);
+	commit = probe;
+
+	fd = open("/dev/raw-gadget", O_RDWR);
+	if (fd < 0)
+		die("/dev/raw-gadget");
+	if (super_speed)
+		init.speed = USB_SPEED_SUPER;
+	snprintf((char *)init.driver_name, UDC_NAME_LENGTH_MAX, "%s", driver);
+	snprintf((char *)init.device_name, UDC_NAME_LENGTH_MAX, "%s", device);
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0)
+		die("raw-gadget init");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		die("raw-gadget run");
+	fprintf(stderr, "d4xx-gadget: %ux%u at %u fps, %s speed\n",
+		width, height, fps, super_speed ? "super" : "high");
+
+	/* SIGUSR2 interrupts the event fetch, so only this thread takes it */
+	fault_seed[0] = getpid();
+	fault_seed[1] = now_ns();
+	sigaction(SIGUSR2, &sa, NULL);
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+
+	for (;;) {
+		ev.event.type = 0;
+		ev.event.length = sizeof(ev.req);
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &ev) < 0) {
+			if (errno != EINTR)
+				die("event fetch");
+			report_faults();
+			continue;
+		}
+		if (ev.event.type != USB_RAW_EVENT_CONTROL)
+			continue;
+		control(&ev.req);
+		if (!started && ep_handle >= 0) {
+			pthread_sigmask(SIG_BLOCK, &usr2, NULL);
+			if (pthread_create(&thread, NULL, stream, NULL))
+				die("pthread_create");
+			pthread_sigmask(SIG_UNBLOCK, &usr2, NULL);
+			started = 1;
+		}
+	}
+}
@@ -0,0 +1,619 @@
+/*
+ * Emulated RealSense D435i IMU for benchmarking the HID sensor drivers
+ *
+ * Creates a uhid device with the D435i IDs whose report descriptor is a
+ * HID sensor hub with a 3D accelerometer and a 3D gyrometer, so that
+ * hid-sensor-hub, hid-sensor-trigger and hid-sensor-accel-3d/-gyro-3d
+ * bind to it as they do to the camera. -D replays another descriptor
+ * instead, e.g. one read from /sys/bus/hid/devices/<id>/report_descriptor
+ * of a real camera; reports are laid out from the parsed descriptor.
+ *
+ * Feature reports are stored as the host sets them and returned on
+ * GET_REPORT. While the host has the device open and a sensor's
+ * reporting state allows events, input reports are sent at the
+ * sensor's report interval or at -r samples per second. The first data
+ * field of each report counts samples, the timestamp field carries
+ * CLOCK_MONOTONIC in microseconds, so buffer timestamps show delivery
+ * latency.
+ *
+ * -f injects faults while SIGUSR2 has toggled injection on: "drop" and
+ * "short" skip or truncate a given fraction of the input reports,
+ * "noreply" leaves a fraction of the GET/SET_REPORT requests unanswered,
+ * so that they time out in uhid, and "error" fails them. The number of
+ * faults injected is printed whenever injection is toggled. Exiting
+ * unplugs the device.
+ *
+ * Usage: d4xx-imu [-r rate] [-D descriptor-file] [-p vid:pid]
+ *                 [-f fault:fraction]...
+ *
+ * Built on demand by imu-bench.sh; needs the uhid module.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/hid.h>
+#include <linux/uhid.h>
+
+#define USAGE_REPORT_INTERVAL   0x20030e
+#define USAGE_REPORTING_STATE   0x200316
+#define USAGE_ALL_EVENTS        0x200841
+#define USAGE_TIMESTAMP         0x200529
+
+#define MAX_FIELDS      64
+#define MAX_SENSORS     8
+#define MAX_REPORT      64
+
+/* Sensor hub modelled on the D435i: one physical collection and report
+ * ID per sensor, reporting and power state as named arrays, the report
+ * interval in milliseconds, 32-bit axes and a 64-bit timestamp in
+ * microseconds */
+#define U16(u)  0x0a, (u) & 0xff, (u) >> 8
+#define SENSOR(usage, id, x) \
+	0x09, usage, 0xa1, 0x00, 0x85, id, \
+	U16(0x0316), 0x15, 0x00, 0x25, 0x01, 0x75, 0x08, 0x95, 0x01, \
+	0xa1, 0x02, U16(0x0840), U16(0x0841), 0xb1, 0x00, 0xc0, \
+	U16(0x0319), 0x15, 0x00, 0x25, 0x05, \
+	0xa1, 0x02, U16(0x0850), U16(0x0851), U16(0x0852), U16(0x0853), \
+	U16(0x0854), U16(0x0855), 0xb1, 0x00, 0xc0, \
+	U16(0x030e), 0x15, 0x00, 0x27, 0xff, 0xff, 0xff, 0x7f, 0x75, 0x20, \
+	0x55, 0x00, 0xb1, 0x02, \
+	0x17, 0x00, 0x00, 0x00, 0x80, 0x27, 0xff, 0xff, 0xff, 0x7f, \
+	U16(x), 0x81, 0x02, U16(x + 1), 0x81, 0x02, U16(x + 2), 0x81, 0x02, \
+	U16(0x0529), 0x75, 0x40, 0x55, 0x0a, 0x81, 0x02, 0x55, 0x00, 0xc0
+
+static const uint8_t default_descriptor[] = {
+	0x05, 0x20, 0x09, 0x01, 0xa1, 0x01,
+	SENSOR(0x73, 1, 0x0453),
+	SENSOR(0x76, 2, 0x0457),
+	0xc0,
+};
+
+struct field {
+	int type;               /* UHID_INPUT_REPORT or UHID_FEATURE_REPORT */
+	uint8_t id;
+	unsigned int offset;    /* in bits, after the report ID */
+	unsigned int size;
+	uint32_t usage;
+	uint32_t physical;
+	uint32_t logical;
+	int32_t logical_min;
+	int all_events;         /* value selecting all events, or -1 */
+};
+
+struct sensor {
+	uint32_t usage;
+	uint8_t input_id;
+	uint8_t feature_id;
+	const struct field *data[8];
+	unsigned int ndata;
+	const struct field *timestamp;
+	const struct field *state;
+	const struct field *interval;
+	uint64_t samples;
+	uint64_t next;
+};
+
+static int fd;
+static unsigned int rate;
+static struct field fields[MAX_FIELDS];
+static unsigned int nfields;
+static struct sensor sensors[MAX_SENSORS];
+static unsigned int nsensors;
+static unsigned int report_bits[3][256];
+static uint8_t features[256][MAX_REPORT];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int opened;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Fault injection */
+
+enum { FAULT_DROP, FAULT_SHORT, FAULT_NOREPLY, FAULT_ERROR, NUM_FAULTS };
+
+static const char *const fault_names[NUM_FAULTS] = { "drop", "short", "noreply", "error" };
+static double fault_fraction[NUM_FAULTS];
+static unsigned long fault_count[NUM_FAULTS];
+static unsigned short fault_seed[3];
+static pthread_mutex_t fault_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t faults_on;
+
+static int parse_fault(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	char *end;
+	int i;
+
+	for (i = 0; colon && i < NUM_FAULTS; i++) {
+		if (strlen(fault_names[i]) != (size_t)(colon - spec) ||
+		    strncmp(spec, fault_names[i], colon - spec))
+			continue;
+		fault_fraction[i] = strtod(colon + 1, &end);
+		return *end == 0 && fault_fraction[i] >= 0 && fault_fraction[i] <= 1;
+	}
+	return 0;
+}
+
+/* Whether to inject the fault now */
+static int inject(int fault)
+{
+	int hit;
+
+	if (!faults_on || !fault_fraction[fault])
+		return 0;
+	pthread_mutex_lock(&fault_lock);
+	hit = erand48(fault_seed) < fault_fraction[fault];
+	fault_count[fault] += hit;
+	pthread_mutex_unlock(&fault_lock);
+	return hit;
+}
+
+static void toggle_faults(int sig)
+{
+	(void)sig;
+	faults_on = !faults_on;
+}
+
+static void report_faults(void)
+{
+	int i;
+
+	pthread_mutex_lock(&fault_lock);
+	fprintf(stderr, "d4xx-imu: fault injection %s, injected so far:", faults_on ? "on" : "off");
+	for (i = 0; i < NUM_FAULTS; i++)
+		fprintf(stderr, " %s %lu", fault_names[i], fault_count[i]);
+	fprintf(stderr, "\n");
+	pthread_mutex_unlock(&fault_lock);
+}
+
+/* Descriptor parsing: just enough of the HID item grammar to place the
+ * fields of each report */
+
+static void parse_descriptor(const uint8_t *d, size_t len)
+{
+	uint32_t usage_page = 0, usages[32], stack_usage[16];
+	unsigned int report_size = 0, report_count = 0, nusages = 0, depth = 0;
+	int stack_type[16];
+	int32_t logical_min = 0;
+	uint8_t report_id = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		uint8_t prefix = d[i], size = prefix & 3, tag = prefix & 0xfc;
+		uint32_t value = 0;
+		unsigned int j;
+
+		if (size == 3)
+			size = 4;
+		if (prefix == 0xfe || i + 1 + size > len)
+			break;          /* long items do not occur in sensor hubs */
+		for (j = 0; j < size; j++)
+			value |= (uint32_t)d[i + 1 + j] << (8 * j);
+		i += 1 + size;
+
+		switch (tag) {
+		case 0x04: usage_page = value; break;
+		case 0x14:
+			logical_min = size == 1 ? (int8_t)value : size == 2 ? (int16_t)value : (int32_t)value;
+			break;
+		case 0x74: report_size = value; break;
+		case 0x84: report_id = value; break;
+		case 0x94: report_count = value; break;
+		case 0x08:
+			if (nusages < 32)
+				usages[nusages++] = size == 4 ? value : usage_page << 16 | value;
+			break;
+		case 0xa0:      /* Collection */
+			if (depth < 16) {
+				stack_type[depth] = value;
+				stack_usage[depth] = nusages ? usages[0] : 0;
+			}
+			depth++;
+			nusages = 0;
+			break;
+		case 0xc0:      /* End Collection */
+			if (depth)
+				depth--;
+			nusages = 0;
+			break;
+		case 0x80:      /* Input */
+		case 0xb0:      /* Feature */
+		case 0x90: {    /* Output */
+			int type = tag == 0x80 ? UHID_INPUT_REPORT : tag == 0xb0 ? UHID_FEATURE_REPORT :
+				   UHID_OUTPUT_REPORT;
+			uint32_t physical = 0, logical = 0;
+			int array = !(value & 0x02);
+			unsigned int k, n = array ? 1 : report_count;
+
+			for (k = depth < 16 ? depth : 16; k-- > 0; ) {
+				if (stack_type[k] == 0x00 && !physical)
+					physical = stack_usage[k];
+				if (stack_type[k] == 0x02 && !logical)
+					logical = stack_usage[k];
+			}
+			for (k = 0; k < n && type != UHID_OUTPUT_REPORT && nfields < MAX_FIELDS; k++) {
+				struct field *f = &fields[nfields++];
+				unsigned int u;
+
+				f->type = type;
+				f->id = report_id;
+				f->offset = report_bits[type][report_id] + k * report_size;
+				f->size = report_size * (array ? report_count : 1);
+				f->usage = nusages ? usages[k < nusages ? k : nusages - 1] : 0;
+				f->physical = physical;
+				f->logical = logical;
+				f->logical_min = logical_min;
+				f->all_events = -1;
+				for (u = 0; array && u < nusages; u++)
+					if (usages[u] == USAGE_ALL_EVENTS)
+						f->all_events = logical_min + u;
+			}
+			report_bits[type][report_id] += report_size * report_count;
+			nusages = 0;
+			break;
+		}
+		}
+	}
+
+	/* Group the fields by the physical collection they belong to */
+	for (i = 0; i < nfields; i++) {
+		const struct field *f = &fields[i];
+		struct sensor *s = NULL;
+		unsigned int k;
+
+		if (!f->physical)
+			continue;
+		for (k = 0; k < nsensors; k++)
+			if (sensors[k].usage == f->physical)
+				s = &sensors[k];
+		if (!s) {
+			if (nsensors == MAX_SENSORS)
+				continue;
+			s = &sensors[nsensors++];
+			s->usage = f->physical;
+		}
+		if (f->type == UHID_FEATURE_REPORT) {
+			s->feature_id = f->id;
+			if (f->logical == USAGE_REPORTING_STATE || f->usage == USAGE_REPORTING_STATE)
+				s->state = f;
+			else if (f->usage == USAGE_REPORT_INTERVAL)
+				s->interval = f;
+		} else {
+			s->input_id = f->id;
+			if (f->usage == USAGE_TIMESTAMP)
+				s->timestamp = f;
+			else if (s->ndata < 8)
+				s->data[s->ndata++] = f;
+		}
+	}
+}
+
+static unsigned int report_len(int type, uint8_t id)
+{
+	return (report_bits[type][id] + 7) / 8 + (id ? 1 : 0);
+}
+
+static void put_field(uint8_t *report, const struct field *f, uint64_t value)
+{
+	uint8_t *p = report + (f->id ? 1 : 0);
+	unsigned int bit;
+
+	for (bit = 0; bit < f->size && bit < 64; bit++) {
+		unsigned int pos = f->offset + bit;
+
+		if (value >> bit & 1)
+			p[pos / 8] |= 1 << (pos % 8);
+		else
+			p[pos / 8] &= ~(1 << (pos % 8));
+	}
+}
+
+static uint64_t get_field(const uint8_t *report, const struct field *f)
+{
+	const uint8_t *p = report + (f->id ? 1 : 0);
+	uint64_t value = 0;
+	unsigned int bit;
+
+	for (bit = 0; bit < f->size && bit < 64; bit++) {
+		unsigned int pos = f->offset + bit;
+
+		value |= (uint64_t)(p[pos / 8] >> (pos % 8) & 1) << bit;
+	}
+	return value;
+}
+
+/* uhid */
+
+static void send_event(struct uhid_event *ev)
+{
+	if (write(fd, ev, sizeof(*ev)) != sizeof(*ev))
+		die("uhid write");
+}
+
+/* Sample n of a sensor: a counter, a slow sine per axis and the time */
+static unsigned int build_input(struct sensor *s, uint8_t *report)
+{
+	unsigned int len = report_len(UHID_INPUT_REPORT, s->input_id), i;
+	double t = now_ns() / 1e9;
+
+	memset(report, 0, len);
+	report[0] = s->input_id;
+	for (i = 0; i < s->ndata; i++)
+		put_field(report, s->data[i], i == 0 ? s->samples : (uint64_t)(int64_t)(1000 * sin(t * i)));
+	if (s->timestamp)
+		put_field(report, s->timestamp, now_ns() / 1000);
+	return len;
+}
+
+static struct sensor *sensor_by_report(int type, uint8_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < nsensors; i++)
+		if ((type == UHID_INPUT_REPORT ? sensors[i].input_id : sensors[i].feature_id) == id)
+			return &sensors[i];
+	return NULL;
+}
+
+static void get_report(const struct uhid_get_report_req *req)
+{
+	struct uhid_event ev = { .type = UHID_GET_REPORT_REPLY };
+	struct sensor *s;
+
+	if (inject(FAULT_NOREPLY))
+		return;
+	ev.u.get_report_reply.id = req->id;
+	pthread_mutex_lock(&lock);
+	if (req->rtype == UHID_FEATURE_REPORT && report_bits[UHID_FEATURE_REPORT][req->rnum]) {
+		ev.u.get_report_reply.size = report_len(UHID_FEATURE_REPORT, req->rnum);
+		memcpy(ev.u.get_report_reply.data, features[req->rnum], ev.u.get_report_reply.size);
+	} else if (req->rtype == UHID_INPUT_REPORT && (s = sensor_by_report(UHID_INPUT_REPORT, req->rnum))) {
+		ev.u.get_report_reply.size = build_input(s, ev.u.get_report_reply.data);
+	} else {
+		ev.u.get_report_reply.err = EIO;
+	}
+	pthread_mutex_unlock(&lock);
+	if (inject(FAULT_ERROR)) {
+		ev.u.get_report_reply.err = EIO;
+		ev.u.get_report_reply.size = 0;
+	}
+	send_event(&ev);
+}
+
+static void set_report(const struct uhid_set_report_req *req)
+{
+	struct uhid_event ev = { .type = UHID_SET_REPORT_REPLY };
+	unsigned int len = report_len(UHID_FEATURE_REPORT, req->rnum);
+
+	if (inject(FAULT_NOREPLY))
+		return;
+	ev.u.set_report_reply.id = req->id;
+	pthread_mutex_lock(&lock);
+	if (inject(FAULT_ERROR)) {
+		ev.u.set_report_reply.err = EIO;
+	} else if (req->rtype == UHID_FEATURE_REPORT && report_bits[UHID_FEATURE_REPORT][req->rnum]) {
+		memcpy(features[req->rnum], req->data, req->size < len ? req->size : len);
+		features[req->rnum][0] = req->rnum;
+		pthread_cond_broadcast(&changed);
+	} else {
+		ev.u.set_report_reply.err = EIO;
+	}
+	pthread_mutex_unlock(&lock);
+	send_event(&ev);
+}
+
+/* Samples per second of a sensor that is reporting, or 0 */
+static unsigned int sensor_rate(const struct sensor *s)
+{
+	const uint8_t *feature = features[s->feature_id];
+	uint64_t interval;
+
+	if (!opened || !s->input_id)
+		return 0;
+	if (s->state && s->state->all_events >= 0 &&
+	    (int64_t)get_field(feature, s->state) != s->state->all_events)
+		return 0;
+	if (rate)
+		return rate;
+	interval = s->interval ? get_field(feature, s->interval) : 0;
+	return interval ? 1000 / interval : 200;
+}
+
+static void *stream(void *arg)
+{
+	struct uhid_event ev = { .type = UHID_INPUT2 };
+	unsigned int i, r;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct sensor *due = NULL;
+		struct timespec ts;
+		uint64_t now = now_ns();
+
+		for (i = 0; i < nsensors; i++) {
+			struct sensor *s = &sensors[i];
+
+			if (!sensor_rate(s)) {
+				s->next = 0;
+				continue;
+			}
+			/* Start over after a pause or when far behind */
+			if (s->next == 0 || now > s->next + 1000000000ull)
+				s->next = now;
+			if (!due || s->next < due->next)
+				due = s;
+		}
+		if (!due) {
+			pthread_cond_wait(&changed, &lock);
+			continue;
+		}
+		if (due->next > now) {
+			ts.tv_sec = due->next / 1000000000ull;
+			ts.tv_nsec = due->next % 1000000000ull;
+			pthread_mutex_unlock(&lock);
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			pthread_mutex_lock(&lock);
+			continue;
+		}
+
+		r = sensor_rate(due);
+		if (!r)
+			continue;
+		due->next += 1000000000ull / r;
+		ev.u.input2.size = build_input(due, ev.u.input2.data);
+		due->samples++;
+		if (inject(FAULT_DROP))
+			continue;
+		if (inject(FAULT_SHORT))
+			ev.u.input2.size /= 2;
+		pthread_mutex_unlock(&lock);
+		send_event(&ev);
+		pthread_mutex_lock(&lock);
+	}
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-r rate] [-D descriptor-file] [-p vid:pid] "
+		"[-f fault:fraction]...\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct uhid_event ev = { .type = UHID_CREATE2 };
+	struct uhid_create2_req *create = &ev.u.create2;
+	unsigned int vid = 0x8086, pid = 0x0b3a, i;
+	const char *descriptor = NULL;
+	struct sigaction sa = { .sa_handler = toggle_faults };
+	sigset_t usr2;
+	pthread_t thread;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:D:p:f:")) != -1) {
+		switch (opt) {
+		case 'r': rate = atoi(optarg); break;
+		case 'D': descriptor = optarg; break;
+		case 'p':
+			if (sscanf(optarg, "%x:%x", &vid, &pid) != 2)
+				usage(argv[0]);
+			break;
+		case 'f':
+			if (!parse_fault(optarg))
+				usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	if (descriptor) {
+		int dfd = open(descriptor, O_RDONLY);
+		ssize_t n;
+
+		if (dfd < 0)
+			die(descriptor);
+		n = read(dfd, create->rd_data, sizeof(create->rd_data));
+		if (n <= 0)
+			die(descriptor);
+		create->rd_size = n;
+		close(dfd);
+	} else {
+		memcpy(create->rd_data, default_descriptor, sizeof(default_descriptor));
+		create->rd_size = sizeof(default_descriptor);
+	}
+	parse_descriptor(create->rd_data, create->rd_size);
+	if (!nsensors) {
+		fprintf(stderr, "d4xx-imu: no sensors in the report descriptor\n");
+		return 1;
+	}
+
+	/* Feature reports start out reporting nothing, every 5 ms */
+	for (i = 0; i < 256; i++)
+		features[i][0] = i;
+	for (i = 0; i < nsensors; i++) {
+		if (sensors[i].interval)
+			put_field(features[sensors[i].feature_id], sensors[i].interval, 5);
+		if (report_len(UHID_INPUT_REPORT, sensors[i].input_id) > MAX_REPORT ||
+		    report_len(UHID_FEATURE_REPORT, sensors[i].feature_id) > MAX_REPORT) {
+			fprintf(stderr, "d4xx-imu: reports larger than %d bytes\n", MAX_REPORT);
+			return 1;
+		}
+		fprintf(stderr, "d4xx-imu: sensor 0x%06x, input report %u (%u bytes), feature report %u\n",
+			sensors[i].usage, sensors[i].input_id,
+			report_len(UHID_INPUT_REPORT, sensors[i].input_id), sensors[i].feature_id);
+	}
+
+	fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		die("/dev/uhid");
+	snprintf((char *)create->name, sizeof(create->name),
+		 "Intel(R) RealSense(TM) Depth Camera 435i");
+	snprintf((char *)create->phys, sizeof(create->phys), "d4xx-imu");
+	create->bus = BUS_USB;
+	create->vendor = vid;
+	create->product = pid;
+	send_event(&ev);
+
+	/* SIGUSR2 interrupts the uhid read, so only this thread takes it */
+	fault_seed[0] = getpid();
+	fault_seed[1] = now_ns();
+	sigaction(SIGUSR2, &sa, NULL);
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &usr2, NULL);
+	if (pthread_create(&thread, NULL, stream, NULL))
+		die("pthread_create");
+	pthread_sigmask(SIG_UNBLOCK, &usr2, NULL);
+
+	for (;;) {
+		memset(&ev, 0, sizeof(ev));
+		if (read(fd, &ev, sizeof(ev)) < 0) {
+			if (errno != EINTR)
+				die("uhid read");
+			report_faults();
+			continue;
+		}
+		switch (ev.type) {
+		case UHID_OPEN:
+		case UHID_CLOSE:
+			pthread_mutex_lock(&lock);
+			opened += ev.type == UHID_OPEN ? 1 : -1;
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+			break;
+		case UHID_GET_REPORT:
+			get_report(&ev.u.get_report);
+			break;
+		case UHID_SET_REPORT:
+			set_report(&ev.u.set_report);
+			break;
+		}
+	}
+}
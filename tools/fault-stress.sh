@@ -0,0 +1,97 @@
+#!/bin/bash
+
+# Fault-injection stress run of the emulated camera, CAN adapter and IMU
+#
+# Usage: fault-stress.sh [--fraction P] [--duration SECONDS]
+#                        [--disconnects N] [--only uvc|gs_usb|imu]...
+#
+#   --fraction P      fraction of payloads, frames or reports hit by each
+#                     fault (default 0.001)
+#   --duration S      seconds of every measurement (default 10)
+#   --disconnects N   unplug and replug each device N times (default 10)
+#   --only D          run only these devices (default: all three)
+#
+# Runs uvc-bench.sh, gs-usb-bench.sh and imu-bench.sh with every fault
+# their emulators know, then with the disconnects. Each benchmark
+# measures without faults, with faults and once more without, so the
+# output shows the throughput lost under faults, the longest gap in the
+# data, whether the driver recovered, how long re-enumeration took and
+# the unreclaimable slab memory gained. Ends with one line per device.
+
+cd "$(dirname "$0")/.." || exit 1
+
+FRACTION=0.001
+DURATION=10
+DISCONNECTS=10
+ONLY=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --fraction)
+            FRACTION="$2"
+            shift
+            ;;
+        --duration)
+            DURATION="$2"
+            shift
+            ;;
+        --disconnects)
+            DISCONNECTS="$2"
+            shift
+            ;;
+        --only)
+            [[ "$2" =~ ^(uvc|gs_usb|imu)$ ]] || { echo "Error: --only needs uvc, gs_usb or imu"; exit 1; }
+            ONLY+=("$2")
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+[ ${#ONLY[@]} -gt 0 ] || ONLY=(uvc gs_usb imu)
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+declare -A BENCH=(
+    [uvc]="tools/uvc-bench.sh --format Z16"
+    [gs_usb]="tools/gs-usb-bench.sh"
+    [imu]="tools/imu-bench.sh"
+)
+# The faults of each emulator, see the header of its source
+declare -A FAULT_NAMES=(
+    [uvc]="short header overflow stall"
+    [gs_usb]="stall-in stall-out short noecho"
+    [imu]="drop short noreply error"
+)
+
+declare -A RESULT
+for dev in "${ONLY[@]}"; do
+    args=(--duration "$DURATION" --disconnects "$DISCONNECTS")
+    for fault in ${FAULT_NAMES[$dev]}; do
+        args+=(--fault "$fault:$FRACTION")
+    done
+    echo "=== $dev"
+    if ${BENCH[$dev]} "${args[@]}"; then
+        RESULT[$dev]="recovered"
+    else
+        RESULT[$dev]="FAILED to recover (see above)"
+    fi
+    echo
+done
+
+echo "Fault stress at fraction $FRACTION, $DISCONNECTS disconnects:"
+failed=0
+for dev in "${ONLY[@]}"; do
+    printf "  %-7s %s\n" "$dev" "${RESULT[$dev]}"
+    [ "${RESULT[$dev]}" = "recovered" ] || failed=1
+done
+exit $failed
@@ -0,0 +1,292 @@
+#!/bin/bash
+
+# Hardware-free gs_usb CAN benchmark
+#
+# Usage: gs-usb-bench.sh [--module gs_usb.ko] [--channels N] [--bitrate B]
+#                        [--frames N] [--duration SECONDS] [--rx-fps N]
+#                        [--no-bus-timing] [--fault NAME:FRACTION]...
+#                        [--disconnects N]
+#
+#   --module FILE     load this gs_usb.ko instead of the installed one
+#   --channels N      CAN channels of the emulated adapter, 1 to 3 (default 1)
+#   --bitrate B       bit rate of every channel (default 1000000)
+#   --frames N        frames sent per channel in the TX test (default 20000)
+#   --duration S      seconds of the RX storm (default 10)
+#   --rx-fps N        RX storm rate over all channels (default: bus speed)
+#   --no-bus-timing   no simulated bus: frames move as fast as USB allows
+#   --fault F:P       then repeat the TX test with fault F injected into
+#                     fraction P of the frames (stall-in, stall-out, short,
+#                     noecho), and once more without faults
+#   --disconnects N   then unplug and replug the adapter N times
+#
+# Loads dummy_hcd and FunctionFS, starts the emulated candleLight adapter
+# of gs-usb-gadget.c (compiled on first use) and measures through
+# gs_usb.ko: TX frames per second, echo latency and kernel CPU per frame
+# with jetson-selftest.py in loopback mode, then an RX storm with the
+# frame rate, kernel CPU per frame and the interfaces' drop counters.
+# The adapter runs on the same machine, so CPU figures include it; they
+# are for before/after comparisons on one machine. With faults or
+# disconnects it also reports how long the adapter took to come back and
+# how much unreclaimable slab memory the kernel gained meanwhile.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MODULE=""
+CHANNELS=1
+BITRATE=1000000
+FRAMES=20000
+DURATION=10
+RX_FPS=0
+BUS_TIMING=""
+FAULTS=()
+DISCONNECTS=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --module)
+            MODULE="$2"
+            [ -f "$MODULE" ] || { echo "Error: --module needs a gs_usb.ko file"; exit 1; }
+            shift
+            ;;
+        --channels)
+            CHANNELS="$2"
+            [[ "$CHANNELS" =~ ^[1-3]$ ]] || { echo "Error: --channels needs 1 to 3"; exit 1; }
+            shift
+            ;;
+        --bitrate)
+            BITRATE="$2"
+            shift
+            ;;
+        --frames)
+            FRAMES="$2"
+            shift
+            ;;
+        --duration)
+            DURATION="$2"
+            shift
+            ;;
+        --rx-fps)
+            RX_FPS="$2"
+            shift
+            ;;
+        --no-bus-timing) BUS_TIMING="-n" ;;
+        --fault)
+            [[ "$2" =~ ^[a-z-]+:[0-9.]+$ ]] || { echo "Error: --fault needs NAME:FRACTION"; exit 1; }
+            FAULTS+=("$2")
+            shift
+            ;;
+        --disconnects)
+            DISCONNECTS="$2"
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+GADGET="build/tools/gs-usb-gadget"
+if [ ! -x "$GADGET" ] || [ tools/gs-usb-gadget.c -nt "$GADGET" ]; then
+    echo "Building gs-usb-gadget..."
+    mkdir -p build/tools
+    cc -O2 -Wall -pthread -o "$GADGET" tools/gs-usb-gadget.c || { echo "Failed to build gs-usb-gadget"; exit 1; }
+fi
+
+echo "Loading dummy_hcd and FunctionFS..."
+modprobe dummy_hcd || { echo "Error: dummy_hcd is not available (CONFIG_USB_DUMMY_HCD)"; exit 1; }
+modprobe usb_f_fs || { echo "Error: FunctionFS is not available (CONFIG_USB_CONFIGFS_F_FS)"; exit 1; }
+modprobe can_raw
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+
+if [ -n "$MODULE" ]; then
+    echo "Loading $MODULE..."
+    modprobe -r gs_usb 2>/dev/null
+    for dep in $(modinfo -F depends "$MODULE" | tr ',' ' '); do
+        modprobe "$dep" || { echo "Failed to load $dep"; exit 1; }
+    done
+    insmod "$MODULE" || { echo "Failed to load $MODULE"; exit 1; }
+fi
+
+NAME="gs_usb_bench"
+G="/sys/kernel/config/usb_gadget/$NAME"
+FFS="/run/$NAME"
+GADGET_PID=""
+PROFILE=$(mktemp)
+
+cleanup() {
+    [ -e "$G/UDC" ] && echo "" > "$G/UDC" 2>/dev/null
+    [ -n "$GADGET_PID" ] && kill "$GADGET_PID" 2>/dev/null && wait "$GADGET_PID" 2>/dev/null
+    mountpoint -q "$FFS" && umount "$FFS"
+    rmdir "$FFS" 2>/dev/null
+    if [ -d "$G" ]; then
+        rm -f "$G/configs/c.1/ffs.$NAME"
+        rmdir "$G/configs/c.1/strings/0x409" "$G/configs/c.1" "$G/functions/ffs.$NAME" \
+              "$G/strings/0x409" "$G" 2>/dev/null
+    fi
+    rm -f "$PROFILE"
+}
+trap cleanup EXIT
+cleanup
+
+# A gadget with the candleLight IDs and one FunctionFS function
+mkdir -p "$G/strings/0x409" "$G/configs/c.1/strings/0x409" "$G/functions/ffs.$NAME" ||
+    { echo "Error: cannot create the gadget (CONFIG_USB_LIBCOMPOSITE)"; exit 1; }
+echo 0x1d50 > "$G/idVendor"
+echo 0x606f > "$G/idProduct"
+echo 0x0200 > "$G/bcdUSB"
+echo "bytewerk" > "$G/strings/0x409/manufacturer"
+echo "candleLight USB to CAN adapter" > "$G/strings/0x409/product"
+echo "000000000001" > "$G/strings/0x409/serialnumber"
+echo "gs_usb" > "$G/configs/c.1/strings/0x409/configuration"
+ln -s "$G/functions/ffs.$NAME" "$G/configs/c.1/"
+mkdir -p "$FFS"
+mount -t functionfs "$NAME" "$FFS" || { echo "Error: cannot mount FunctionFS"; exit 1; }
+
+fault_args=()
+for fault in "${FAULTS[@]}"; do
+    fault_args+=(-f "$fault")
+done
+"$GADGET" -c "$CHANNELS" -R "$RX_FPS" $BUS_TIMING "${fault_args[@]}" "$FFS" &
+GADGET_PID=$!
+for (( i = 0; i < 50; i++ )); do
+    [ -e "$FFS/ep2" ] && break
+    kill -0 "$GADGET_PID" 2>/dev/null || { echo "Error: gs-usb-gadget exited"; exit 1; }
+    sleep 0.1
+done
+UDC=$(basename "$(ls -d /sys/class/udc/dummy_udc.* | head -n 1)")
+echo "$UDC" > "$G/UDC" || { echo "Error: cannot bind the gadget to dummy_udc"; exit 1; }
+
+# The adapter's interfaces are the gs_usb ones behind dummy_hcd. Waits
+# up to 10 s for them.
+find_ifaces() {
+    local node i
+    for (( i = 0; i < 1000; i++ )); do
+        ifaces=()
+        for node in /sys/class/net/can*; do
+            [ -e "$node" ] || continue
+            [[ "$(readlink -f "$node/device")" == */dummy_hcd* ]] || continue
+            [ "$(basename "$(readlink -f "$node/device/driver")")" = "gs_usb" ] && ifaces+=("${node##*/}")
+        done
+        [ ${#ifaces[@]} -ge "$CHANNELS" ] && return 0
+        sleep 0.01
+    done
+    return 1
+}
+
+find_ifaces || { echo "Error: the emulated adapter did not appear"; exit 1; }
+echo "Emulated adapter at ${ifaces[*]}, $BITRATE bit/s${BUS_TIMING:+, no bus timing}"
+
+# Every echo must arrive; the rate limit is left to the reader
+{
+    echo "selftest can-bitrate $BITRATE"
+    echo "selftest can-frames $FRAMES"
+    echo "selftest can-min-fps 0"
+} > "$PROFILE"
+
+tx_test() {
+    local ifname args=()
+    for ifname in "${ifaces[@]}"; do
+        args+=(--can "$ifname")
+    done
+    PYTHONUNBUFFERED=1 python3 install-modules/jetson-selftest.py --profile "$PROFILE" "${args[@]}" |
+        grep -v '^Self-test:'
+    return "${PIPESTATUS[0]}"
+}
+
+failed=0
+tx_test || failed=1
+
+stat_sum() {
+    local ifname total=0
+    for ifname in "${ifaces[@]}"; do
+        total=$(( total + $(cat "/sys/class/net/$ifname/statistics/$1") ))
+    done
+    echo "$total"
+}
+
+# System, IRQ and softirq time of all CPUs, as in jetson-selftest.py
+kernel_ticks() {
+    awk '/^cpu / { print $4 + $7 + $8; exit }' /proc/stat
+}
+
+echo "RX storm on ${ifaces[*]} for $DURATION s..."
+for ifname in "${ifaces[@]}"; do
+    ip link set "$ifname" type can bitrate "$BITRATE" && ip link set "$ifname" up ||
+        { echo "Error: cannot bring up $ifname"; exit 1; }
+done
+rx=$(stat_sum rx_packets)
+dropped=$(stat_sum rx_dropped)
+overruns=$(stat_sum rx_over_errors)
+ticks=$(kernel_ticks)
+start=$(date +%s.%N)
+kill -USR1 "$GADGET_PID"
+sleep "$DURATION"
+kill -USR1 "$GADGET_PID"
+end=$(date +%s.%N)
+rx=$(( $(stat_sum rx_packets) - rx ))
+dropped=$(( $(stat_sum rx_dropped) - dropped ))
+overruns=$(( $(stat_sum rx_over_errors) - overruns ))
+ticks=$(( $(kernel_ticks) - ticks ))
+for ifname in "${ifaces[@]}"; do
+    ip link set "$ifname" down
+done
+awk -v rx="$rx" -v t="$ticks" -v hz="$(getconf CLK_TCK)" -v s="$start" -v e="$end" 'BEGIN {
+    printf "        %d frames received, %.0f frames/s\n", rx, rx / (e - s)
+    if (rx > 0)
+        printf "        kernel CPU: %.1f us per frame\n", t * 1e6 / hz / rx
+}'
+echo "        $dropped dropped, $overruns overruns"
+[ "$rx" -gt 0 ] || failed=1
+
+# Unreclaimable slab in kB: what leaks on error paths end up in
+slab_kb() {
+    awk '/^SUnreclaim:/ { print $2 }' /proc/meminfo
+}
+
+if [ ${#FAULTS[@]} -gt 0 ]; then
+    slab=$(slab_kb)
+    echo "Injecting faults: ${FAULTS[*]}"
+    kill -USR2 "$GADGET_PID"
+    tx_test
+    kill -USR2 "$GADGET_PID"
+    echo "Without faults again:"
+    tx_test || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the faults"
+fi
+
+if [ "$DISCONNECTS" -gt 0 ]; then
+    slab=$(slab_kb)
+    echo "Unplugging the adapter $DISCONNECTS times..."
+    for (( n = 1; n <= DISCONNECTS; n++ )); do
+        echo disconnect > "/sys/class/udc/$UDC/soft_connect"
+        for (( i = 0; i < 500; i++ )); do
+            [ -e "/sys/class/net/${ifaces[0]}" ] || break
+            sleep 0.01
+        done
+        start=$(date +%s%N)
+        echo connect > "/sys/class/udc/$UDC/soft_connect"
+        if find_ifaces; then
+            echo "        $n: back at ${ifaces[*]} after $(( ($(date +%s%N) - start) / 1000000 )) ms"
+        else
+            echo "        $n: the adapter did not come back"
+            failed=1
+            break
+        fi
+    done
+    udevadm settle 2>/dev/null
+    tx_test || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the disconnects"
+fi
+
+[ $failed -eq 0 ] || { echo "Benchmark finished with failures"; exit 1; }
+echo "Benchmark finished"
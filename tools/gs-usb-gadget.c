@@ -0,0 +1,661 @@
+/*
+ * Emulated candleLight CAN adapter for benchmarking gs_usb
+ *
+ * Implements the device side of the gs_usb protocol on a FunctionFS
+ * instance, normally bound to dummy_hcd so that the host side is the
+ * same machine: the vendor requests for host format, device config,
+ * bit timing constants, bit timing, mode and identify, and the
+ * gs_host_frame exchange on bulk endpoints 0x81 and 0x02.
+ *
+ * Frames from the host are "sent" on a simulated bus whose speed comes
+ * from the configured bit timing, then echoed back with their echo ID,
+ * and received once more if the channel is in loopback mode. SIGUSR1
+ * toggles a storm of received frames on every started channel, each at
+ * its own bus speed, or at -R frames per second over all channels. With
+ * -T the device offers hardware timestamps, which gs_usb uses from Linux
+ * 6.0 on.
+ *
+ * -f injects faults, each into a given fraction of the frames, while
+ * SIGUSR2 has toggled injection on: "stall-in" halts the IN endpoint for
+ * 10 ms instead of sending a frame to the host, "stall-out" halts the
+ * OUT endpoint instead of transmitting a frame from the host, "short"
+ * sends only the first 8 bytes of a frame and "noecho" transmits a frame
+ * without echoing it. The number of faults injected is printed whenever
+ * injection is toggled.
+ *
+ * Structures are in host order: little-endian hosts only.
+ *
+ * Usage: gs-usb-gadget [-c channels] [-R rx-fps] [-n] [-T]
+ *                      [-f fault:fraction]... ffs-mountpoint
+ *
+ *   -n    no bus timing: echo and receive as fast as the host reads
+ *
+ * Built on demand by gs-usb-bench.sh, which also sets up the gadget in
+ * configfs; needs <linux/usb/functionfs.h>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+
+#define MAX_CHANNELS    3       /* GS_MAX_INTF in gs_usb */
+#define CAN_CLOCK_HZ    48000000
+#define STALL_US        10000
+
+/* Protocol of drivers/net/can/usb/gs_usb.c */
+enum gs_usb_breq {
+	GS_USB_BREQ_HOST_FORMAT = 0,
+	GS_USB_BREQ_BITTIMING,
+	GS_USB_BREQ_MODE,
+	GS_USB_BREQ_BERR,
+	GS_USB_BREQ_BT_CONST,
+	GS_USB_BREQ_DEVICE_CONFIG,
+	GS_USB_BREQ_TIMESTAMP,
+	GS_USB_BREQ_IDENTIFY,
+};
+
+#define GS_CAN_MODE_RESET       0
+#define GS_CAN_MODE_START       1
+
+#define GS_CAN_MODE_LISTEN_ONLY (1 << 0)
+#define GS_CAN_MODE_LOOP_BACK   (1 << 1)
+#define GS_CAN_MODE_TRIPLE_SAMPLE (1 << 2)
+#define GS_CAN_MODE_ONE_SHOT    (1 << 3)
+#define GS_CAN_MODE_HW_TIMESTAMP (1 << 4)
+
+#define GS_CAN_FEATURE_LISTEN_ONLY (1 << 0)
+#define GS_CAN_FEATURE_LOOP_BACK (1 << 1)
+#define GS_CAN_FEATURE_TRIPLE_SAMPLE (1 << 2)
+#define GS_CAN_FEATURE_ONE_SHOT (1 << 3)
+#define GS_CAN_FEATURE_HW_TIMESTAMP (1 << 4)
+#define GS_CAN_FEATURE_IDENTIFY (1 << 5)
+
+#define CAN_EFF_FLAG    0x80000000U
+#define CAN_RTR_FLAG    0x40000000U
+
+struct gs_host_config {
+	uint32_t byte_order;
+} __attribute__((packed));
+
+struct gs_device_config {
+	uint8_t reserved1;
+	uint8_t reserved2;
+	uint8_t reserved3;
+	uint8_t icount;
+	uint32_t sw_version;
+	uint32_t hw_version;
+} __attribute__((packed));
+
+struct gs_device_mode {
+	uint32_t mode;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct gs_device_bittiming {
+	uint32_t prop_seg;
+	uint32_t phase_seg1;
+	uint32_t phase_seg2;
+	uint32_t sjw;
+	uint32_t brp;
+} __attribute__((packed));
+
+struct gs_device_bt_const {
+	uint32_t feature;
+	uint32_t fclk_can;
+	uint32_t tseg1_min;
+	uint32_t tseg1_max;
+	uint32_t tseg2_min;
+	uint32_t tseg2_max;
+	uint32_t sjw_max;
+	uint32_t brp_min;
+	uint32_t brp_max;
+	uint32_t brp_inc;
+} __attribute__((packed));
+
+struct gs_host_frame {
+	uint32_t echo_id;
+	uint32_t can_id;
+	uint8_t can_dlc;
+	uint8_t channel;
+	uint8_t flags;
+	uint8_t reserved;
+	uint8_t data[8];
+	uint32_t timestamp_us;  /* only with GS_CAN_MODE_HW_TIMESTAMP */
+} __attribute__((packed));
+
+#define FRAME_SIZE      offsetof(struct gs_host_frame, timestamp_us)
+
+struct channel {
+	int started;
+	uint32_t flags;
+	uint32_t bitrate;
+};
+
+static int ep0, ep_in, ep_out;
+static unsigned int num_channels = 1, rx_fps;
+static int bus_timing = 1, hw_timestamp;
+static volatile sig_atomic_t storm;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct channel channels[MAX_CHANNELS];
+static uint64_t bus_free[MAX_CHANNELS];
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = { t / 1000000000ull, t % 1000000000ull };
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* Fault injection */
+
+enum { FAULT_STALL_IN, FAULT_STALL_OUT, FAULT_SHORT, FAULT_NOECHO, NUM_FAULTS };
+
+static const char *const fault_names[NUM_FAULTS] = { "stall-in", "stall-out", "short", "noecho" };
+static double fault_fraction[NUM_FAULTS];
+static unsigned long fault_count[NUM_FAULTS];
+static unsigned short fault_seed[3];
+static pthread_mutex_t fault_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t faults_on;
+
+static int parse_fault(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	char *end;
+	int i;
+
+	for (i = 0; colon && i < NUM_FAULTS; i++) {
+		if (strlen(fault_names[i]) != (size_t)(colon - spec) ||
+		    strncmp(spec, fault_names[i], colon - spec))
+			continue;
+		fault_fraction[i] = strtod(colon + 1, &end);
+		return *end == 0 && fault_fraction[i] >= 0 && fault_fraction[i] <= 1;
+	}
+	return 0;
+}
+
+/* Whether to inject the fault now */
+static int inject(int fault)
+{
+	int hit;
+
+	if (!faults_on || !fault_fraction[fault])
+		return 0;
+	pthread_mutex_lock(&fault_lock);
+	hit = erand48(fault_seed) < fault_fraction[fault];
+	fault_count[fault] += hit;
+	pthread_mutex_unlock(&fault_lock);
+	return hit;
+}
+
+static void toggle_faults(int sig)
+{
+	(void)sig;
+	faults_on = !faults_on;
+}
+
+static void report_faults(void)
+{
+	int i;
+
+	pthread_mutex_lock(&fault_lock);
+	fprintf(stderr, "gs-usb-gadget: fault injection %s, injected so far:", faults_on ? "on" : "off");
+	for (i = 0; i < NUM_FAULTS; i++)
+		fprintf(stderr, " %s %lu", fault_names[i], fault_count[i]);
+	fprintf(stderr, "\n");
+	pthread_mutex_unlock(&fault_lock);
+}
+
+/* FunctionFS halts an endpoint on a transfer in the wrong direction;
+ * the halt is cleared again after a while, as the host never does */
+static void stall(int ep, int in)
+{
+	if (in)
+		(void)!read(ep, NULL, 0);
+	else
+		(void)!write(ep, NULL, 0);
+	usleep(STALL_US);
+	if (ioctl(ep, FUNCTIONFS_CLEAR_HALT) < 0)
+		perror("clear halt");
+}
+
+/* Descriptors */
+
+static const struct {
+	struct usb_functionfs_descs_head_v2 header;
+	uint32_t fs_count;
+	uint32_t hs_count;
+	struct {
+		struct usb_interface_descriptor intf;
+		struct usb_endpoint_descriptor_no_audio in;
+		struct usb_endpoint_descriptor_no_audio out;
+	} __attribute__((packed)) fs, hs;
+} __attribute__((packed)) descriptors = {
+	.header = {
+		.magic = FUNCTIONFS_DESCRIPTORS_MAGIC_V2,
+		.length = sizeof(descriptors),
+		.flags = FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC,
+	},
+	.fs_count = 3,
+	.hs_count = 3,
+#define DESCS(maxpacket) { \
+		.intf = { \
+			.bLength = USB_DT_INTERFACE_SIZE, \
+			.bDescriptorType = USB_DT_INTERFACE, \
+			.bNumEndpoints = 2, \
+			.bInterfaceClass = USB_CLASS_VENDOR_SPEC, \
+			.bInterfaceSubClass = 0xff, \
+			.bInterfaceProtocol = 0xff, \
+			.iInterface = 1, \
+		}, \
+		.in = { \
+			.bLength = USB_DT_ENDPOINT_SIZE, \
+			.bDescriptorType = USB_DT_ENDPOINT, \
+			.bEndpointAddress = 1 | USB_DIR_IN, \
+			.bmAttributes = USB_ENDPOINT_XFER_BULK, \
+			.wMaxPacketSize = maxpacket, \
+		}, \
+		.out = { \
+			.bLength = USB_DT_ENDPOINT_SIZE, \
+			.bDescriptorType = USB_DT_ENDPOINT, \
+			.bEndpointAddress = 2 | USB_DIR_OUT, \
+			.bmAttributes = USB_ENDPOINT_XFER_BULK, \
+			.wMaxPacketSize = maxpacket, \
+		}, \
+	}
+	.fs = DESCS(64),
+	.hs = DESCS(512),
+#undef DESCS
+};
+
+#define STR_INTERFACE "candleLight"
+
+static const struct {
+	struct usb_functionfs_strings_head header;
+	struct {
+		uint16_t code;
+		char str[sizeof(STR_INTERFACE)];
+	} __attribute__((packed)) lang0;
+} __attribute__((packed)) strings = {
+	.header = {
+		.magic = FUNCTIONFS_STRINGS_MAGIC,
+		.length = sizeof(strings),
+		.str_count = 1,
+		.lang_count = 1,
+	},
+	.lang0 = { 0x0409, STR_INTERFACE },
+};
+
+/* Control requests */
+
+static void ep0_stall(const struct usb_ctrlrequest *req)
+{
+	/* FunctionFS stalls ep0 on a transfer in the wrong direction */
+	if (req->bRequestType & USB_DIR_IN)
+		(void)!read(ep0, NULL, 0);
+	else
+		(void)!write(ep0, NULL, 0);
+}
+
+static void control_in(const struct usb_ctrlrequest *req, uint16_t channel)
+{
+	union {
+		struct gs_device_config config;
+		struct gs_device_bt_const bt_const;
+		uint32_t timestamp;
+	} reply;
+	size_t len;
+
+	memset(&reply, 0, sizeof(reply));
+	switch (req->bRequest) {
+	case GS_USB_BREQ_DEVICE_CONFIG:
+		reply.config.icount = num_channels - 1;
+		reply.config.sw_version = 2;
+		reply.config.hw_version = 1;
+		len = sizeof(reply.config);
+		break;
+	case GS_USB_BREQ_BT_CONST:
+		/* The limits of the STM32F0 bxCAN in the candleLight firmware */
+		reply.bt_const.feature = GS_CAN_FEATURE_LISTEN_ONLY | GS_CAN_FEATURE_LOOP_BACK |
+					 GS_CAN_FEATURE_ONE_SHOT | GS_CAN_FEATURE_IDENTIFY |
+					 (hw_timestamp ? GS_CAN_FEATURE_HW_TIMESTAMP : 0);
+		reply.bt_const.fclk_can = CAN_CLOCK_HZ;
+		reply.bt_const.tseg1_min = 1;
+		reply.bt_const.tseg1_max = 16;
+		reply.bt_const.tseg2_min = 1;
+		reply.bt_const.tseg2_max = 8;
+		reply.bt_const.sjw_max = 4;
+		reply.bt_const.brp_min = 1;
+		reply.bt_const.brp_max = 1024;
+		reply.bt_const.brp_inc = 1;
+		len = sizeof(reply.bt_const);
+		break;
+	case GS_USB_BREQ_TIMESTAMP:
+		reply.timestamp = now_ns() / 1000;
+		len = sizeof(reply.timestamp);
+		break;
+	default:
+		ep0_stall(req);
+		return;
+	}
+	if (channel >= num_channels && req->bRequest != GS_USB_BREQ_DEVICE_CONFIG) {
+		ep0_stall(req);
+		return;
+	}
+	if (len > req->wLength)
+		len = req->wLength;
+	if (write(ep0, &reply, len) < 0)
+		perror("ep0 write");
+}
+
+static void control_out(const struct usb_ctrlrequest *req, uint16_t channel)
+{
+	union {
+		struct gs_host_config host;
+		struct gs_device_bittiming bt;
+		struct gs_device_mode mode;
+		uint8_t raw[64];
+	} data;
+	struct channel *ch = &channels[channel < MAX_CHANNELS ? channel : 0];
+	uint32_t tq;
+
+	memset(&data, 0, sizeof(data));
+	if (req->wLength > sizeof(data) ||
+	    (channel >= num_channels && req->bRequest != GS_USB_BREQ_HOST_FORMAT)) {
+		ep0_stall(req);
+		return;
+	}
+	if (read(ep0, &data, req->wLength) < 0) {
+		perror("ep0 read");
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	switch (req->bRequest) {
+	case GS_USB_BREQ_HOST_FORMAT:
+		if (data.host.byte_order != 0x0000beef)
+			fprintf(stderr, "gs-usb-gadget: unexpected byte order 0x%08x\n",
+				data.host.byte_order);
+		break;
+	case GS_USB_BREQ_BITTIMING:
+		tq = 1 + data.bt.prop_seg + data.bt.phase_seg1 + data.bt.phase_seg2;
+		ch->bitrate = CAN_CLOCK_HZ / (data.bt.brp ? data.bt.brp : 1) / tq;
+		fprintf(stderr, "gs-usb-gadget: channel %u at %u bit/s\n", channel, ch->bitrate);
+		break;
+	case GS_USB_BREQ_MODE:
+		ch->started = data.mode.mode == GS_CAN_MODE_START;
+		ch->flags = data.mode.flags;
+		bus_free[channel] = 0;
+		fprintf(stderr, "gs-usb-gadget: channel %u %s, flags 0x%x\n", channel,
+			ch->started ? "started" : "reset", ch->flags);
+		break;
+	case GS_USB_BREQ_BERR:
+	case GS_USB_BREQ_IDENTIFY:
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Bus */
+
+/* Nominal length of a classic frame without stuffing, plus the
+ * intermission */
+static unsigned int frame_bits(const struct gs_host_frame *hf)
+{
+	unsigned int dlc = hf->can_dlc > 8 ? 8 : hf->can_dlc;
+
+	if (hf->can_id & CAN_RTR_FLAG)
+		dlc = 0;
+	return (hf->can_id & CAN_EFF_FLAG ? 64 : 44) + 8 * dlc + 3;
+}
+
+/* Occupy the channel's bus for one frame and wait for it to pass; false
+ * once the channel is stopped */
+static int transmit(unsigned int channel, const struct gs_host_frame *hf)
+{
+	uint64_t done;
+
+	pthread_mutex_lock(&lock);
+	if (!channels[channel].started) {
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	done = now_ns();
+	if (bus_timing) {
+		if (bus_free[channel] > done)
+			done = bus_free[channel];
+		done += frame_bits(hf) * 1000000000ull / (channels[channel].bitrate ? : 1000000);
+		bus_free[channel] = done;
+	}
+	pthread_mutex_unlock(&lock);
+	if (bus_timing)
+		sleep_until(done);
+	return 1;
+}
+
+static pthread_mutex_t in_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int send_to_host(struct gs_host_frame *hf)
+{
+	size_t len = FRAME_SIZE;
+	int ret;
+
+	if (channels[hf->channel].flags & GS_CAN_MODE_HW_TIMESTAMP) {
+		hf->timestamp_us = now_ns() / 1000;
+		len = sizeof(*hf);
+	}
+	if (inject(FAULT_SHORT))
+		len = 8;
+	pthread_mutex_lock(&in_lock);
+	if (inject(FAULT_STALL_IN)) {
+		/* No IN transfer is queued while in_lock is held */
+		stall(ep_in, 1);
+		pthread_mutex_unlock(&in_lock);
+		return -1;
+	}
+	ret = write(ep_in, hf, len);
+	pthread_mutex_unlock(&in_lock);
+	if (ret < 0 && errno != ESHUTDOWN && errno != EINTR)
+		perror("ep1 write");
+	return ret;
+}
+
+/* Frames from the host: transmit, echo, loop back */
+static void *tx_thread(void *arg)
+{
+	struct gs_host_frame hf;
+	ssize_t n;
+
+	(void)arg;
+	for (;;) {
+		n = read(ep_out, &hf, sizeof(hf));
+		if (n < 0) {
+			if (errno != ESHUTDOWN && errno != EINTR)
+				perror("ep2 read");
+			usleep(10000);
+			continue;
+		}
+		if (n < (ssize_t)FRAME_SIZE || hf.channel >= num_channels)
+			continue;
+		if (inject(FAULT_STALL_OUT)) {
+			stall(ep_out, 0);
+			continue;
+		}
+		if (!transmit(hf.channel, &hf))
+			continue;
+		if (!inject(FAULT_NOECHO))
+			send_to_host(&hf);
+		if (channels[hf.channel].flags & GS_CAN_MODE_LOOP_BACK) {
+			hf.echo_id = 0xffffffff;
+			send_to_host(&hf);
+		}
+	}
+	return NULL;
+}
+
+/* Frames from other nodes on one channel, while the storm is on; -R is
+ * shared out over the channels */
+static void *rx_thread(void *arg)
+{
+	unsigned int channel = (uintptr_t)arg;
+	uint64_t next = 0, counter = 0;
+
+	for (;;) {
+		struct gs_host_frame hf = {
+			.echo_id = 0xffffffff,
+			.can_dlc = 8,
+		};
+
+		if (!storm || !channels[channel].started) {
+			usleep(10000);
+			next = 0;
+			continue;
+		}
+		if (rx_fps) {
+			if (next == 0 || now_ns() > next + 1000000000ull)
+				next = now_ns();
+			sleep_until(next);
+			next += num_channels * 1000000000ull / rx_fps;
+		}
+
+		hf.can_id = 0x100 + (counter & 0xff);
+		hf.channel = channel;
+		memcpy(hf.data, &counter, sizeof(hf.data));
+		counter++;
+		if (transmit(channel, &hf))
+			send_to_host(&hf);
+	}
+	return NULL;
+}
+
+static void toggle_storm(int sig)
+{
+	(void)sig;
+	storm = !storm;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-c channels] [-R rx-fps] [-n] [-T] [-f fault:fraction]... "
+		"ffs-mountpoint\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct usb_functionfs_event events[4];
+	struct sigaction sa = { .sa_handler = toggle_faults };
+	sigset_t usr2;
+	char path[256];
+	pthread_t thread;
+	ssize_t n;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:R:nTf:")) != -1) {
+		switch (opt) {
+		case 'c': num_channels = atoi(optarg); break;
+		case 'R': rx_fps = atoi(optarg); break;
+		case 'n': bus_timing = 0; break;
+		case 'T': hw_timestamp = 1; break;
+		case 'f':
+			if (!parse_fault(optarg))
+				usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || num_channels < 1 || num_channels > MAX_CHANNELS)
+		usage(argv[0]);
+
+	snprintf(path, sizeof(path), "%s/ep0", argv[optind]);
+	ep0 = open(path, O_RDWR);
+	if (ep0 < 0)
+		die(path);
+	if (write(ep0, &descriptors, sizeof(descriptors)) < 0)
+		die("descriptors");
+	if (write(ep0, &strings, sizeof(strings)) < 0)
+		die("strings");
+
+	/* Endpoint files are numbered in descriptor order */
+	snprintf(path, sizeof(path), "%s/ep1", argv[optind]);
+	ep_in = open(path, O_RDWR);
+	if (ep_in < 0)
+		die(path);
+	snprintf(path, sizeof(path), "%s/ep2", argv[optind]);
+	ep_out = open(path, O_RDWR);
+	if (ep_out < 0)
+		die(path);
+
+	/* SIGUSR2 interrupts the ep0 read, so only this thread takes it */
+	fault_seed[0] = getpid();
+	fault_seed[1] = now_ns();
+	signal(SIGUSR1, toggle_storm);
+	sigaction(SIGUSR2, &sa, NULL);
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &usr2, NULL);
+	if (pthread_create(&thread, NULL, tx_thread, NULL))
+		die("pthread_create");
+	for (i = 0; i < (int)num_channels; i++)
+		if (pthread_create(&thread, NULL, rx_thread, (void *)(uintptr_t)i))
+			die("pthread_create");
+	pthread_sigmask(SIG_UNBLOCK, &usr2, NULL);
+	fprintf(stderr, "gs-usb-gadget: %u channel(s)%s%s\n", num_channels,
+		bus_timing ? "" : ", no bus timing", hw_timestamp ? ", hardware timestamps" : "");
+
+	for (;;) {
+		n = read(ep0, events, sizeof(events));
+		if (n < 0) {
+			if (errno != EINTR)
+				die("ep0 read");
+			report_faults();
+			continue;
+		}
+		for (i = 0; i < n / (ssize_t)sizeof(events[0]); i++) {
+			const struct usb_ctrlrequest *req = &events[i].u.setup;
+
+			switch (events[i].type) {
+			case FUNCTIONFS_SETUP:
+				if ((req->bRequestType & USB_TYPE_MASK) != USB_TYPE_VENDOR)
+					ep0_stall(req);
+				else if (req->bRequestType & USB_DIR_IN)
+					control_in(req, req->wValue);
+				else
+					control_out(req, req->wValue);
+				break;
+			case FUNCTIONFS_DISABLE:
+			case FUNCTIONFS_UNBIND:
+				pthread_mutex_lock(&lock);
+				memset(channels, 0, sizeof(channels));
+				pthread_mutex_unlock(&lock);
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,209 @@
+#!/bin/bash
+
+# Hardware-free RealSense IMU benchmark for the HID sensor drivers
+#
+# Usage: imu-bench.sh [--modules DIR] [--rate N] [--duration SECONDS]
+#                     [--descriptor FILE] [--fault NAME:FRACTION]...
+#                     [--disconnects N]
+#
+#   --modules DIR      load the hid-sensor-*.ko of DIR instead of the
+#                      installed ones, e.g. install-modules
+#   --rate N           samples per second of each sensor (default 1000;
+#                      0 follows the sampling frequency set by the host)
+#   --duration S       seconds read per sensor (default 10)
+#   --descriptor FILE  report descriptor to replay, e.g. saved from
+#                      /sys/bus/hid/devices/<id>/report_descriptor of a D435i
+#   --fault F:P        then read again with fault F injected into fraction P
+#                      of the reports or requests (drop, short, noreply,
+#                      error), and once more without faults
+#   --disconnects N    then unplug and replug the IMU N times
+#
+# Loads uhid and the HID sensor drivers, starts the emulated D435i IMU of
+# d4xx-imu.c (compiled on first use) and reads the accelerometer and the
+# gyrometer through hid-sensor-hub, hid-sensor-trigger and the IIO
+# buffer with jetson-selftest.py: samples per second, samples lost,
+# delivery latency from the report to the reader and kernel CPU per
+# sample. The emulator runs on the same machine, so CPU figures include
+# it; they are for before/after comparisons on one machine. With faults
+# or disconnects it also reports how long the IMU took to come back and
+# how much unreclaimable slab memory the kernel gained meanwhile.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MODULES_DIR=""
+RATE=1000
+DURATION=10
+DESCRIPTOR=""
+FAULTS=()
+DISCONNECTS=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --modules)
+            MODULES_DIR="$2"
+            [ -f "$MODULES_DIR/hid-sensor-hub.ko" ] || { echo "Error: no hid-sensor-hub.ko in $MODULES_DIR"; exit 1; }
+            shift
+            ;;
+        --rate)
+            RATE="$2"
+            shift
+            ;;
+        --duration)
+            DURATION="$2"
+            shift
+            ;;
+        --descriptor)
+            DESCRIPTOR="$2"
+            [ -f "$DESCRIPTOR" ] || { echo "Error: --descriptor needs a file"; exit 1; }
+            shift
+            ;;
+        --fault)
+            [[ "$2" =~ ^[a-z]+:[0-9.]+$ ]] || { echo "Error: --fault needs NAME:FRACTION"; exit 1; }
+            FAULTS+=("$2")
+            shift
+            ;;
+        --disconnects)
+            DISCONNECTS="$2"
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+EMULATOR="build/tools/d4xx-imu"
+if [ ! -x "$EMULATOR" ] || [ tools/d4xx-imu.c -nt "$EMULATOR" ]; then
+    echo "Building d4xx-imu..."
+    mkdir -p build/tools
+    cc -O2 -Wall -pthread -o "$EMULATOR" tools/d4xx-imu.c -lm || { echo "Failed to build d4xx-imu"; exit 1; }
+fi
+
+echo "Loading uhid and the HID sensor drivers..."
+modprobe uhid || { echo "Error: uhid is not available (CONFIG_UHID)"; exit 1; }
+# In dependency order, as install-jetson-modules.sh loads them
+SENSOR_MODULES=(hid-sensor-hub hid-sensor-iio-common hid-sensor-trigger hid-sensor-accel-3d hid-sensor-gyro-3d)
+if [ -n "$MODULES_DIR" ]; then
+    for (( i = ${#SENSOR_MODULES[@]} - 1; i >= 0; i-- )); do
+        modprobe -r "${SENSOR_MODULES[$i]}" 2>/dev/null
+    done
+    for module in "${SENSOR_MODULES[@]}"; do
+        for dep in $(modinfo -F depends "$MODULES_DIR/$module.ko" | tr ',' ' '); do
+            [[ " ${SENSOR_MODULES[*]} " == *" $dep "* ]] || modprobe "$dep" || { echo "Failed to load $dep"; exit 1; }
+        done
+        insmod "$MODULES_DIR/$module.ko" || { echo "Failed to load $module.ko"; exit 1; }
+    done
+else
+    for module in "${SENSOR_MODULES[@]}"; do
+        modprobe "$module" || { echo "Failed to load $module"; exit 1; }
+    done
+fi
+
+EMULATOR_PID=""
+PROFILE=$(mktemp)
+trap '[ -n "$EMULATOR_PID" ] && kill "$EMULATOR_PID" 2>/dev/null; rm -f "$PROFILE"' EXIT
+
+fault_args=()
+for fault in "${FAULTS[@]}"; do
+    fault_args+=(-f "$fault")
+done
+start_emulator() {
+    "$EMULATOR" -r "$RATE" ${DESCRIPTOR:+-D "$DESCRIPTOR"} "${fault_args[@]}" &
+    EMULATOR_PID=$!
+}
+
+# The emulator's sensors are the IIO devices below the uhid device.
+# Waits up to 10 s for both of them.
+find_devices() {
+    local dev i
+    for (( i = 0; i < 1000; i++ )); do
+        devices=()
+        for dev in /sys/bus/iio/devices/iio:device*; do
+            [ -e "$dev" ] || continue
+            [[ "$(readlink -f "$dev")" == */uhid/*HID-SENSOR-* ]] && devices+=("${dev##*/}")
+        done
+        [ ${#devices[@]} -ge 2 ] && return 0
+        kill -0 "$EMULATOR_PID" 2>/dev/null || { echo "Error: d4xx-imu exited"; exit 1; }
+        sleep 0.01
+    done
+    [ ${#devices[@]} -gt 0 ]
+}
+
+start_emulator
+find_devices || { echo "Error: the emulated IMU did not appear"; exit 1; }
+udevadm settle 2>/dev/null
+if [ "$RATE" -gt 0 ]; then
+    echo "Emulated IMU at ${devices[*]}, $RATE samples/s per sensor"
+else
+    echo "Emulated IMU at ${devices[*]}, at the host's sampling frequency"
+fi
+
+echo "selftest imu-max-loss-pct 0" > "$PROFILE"
+
+read_imu() {
+    local dev args=()
+    for dev in "${devices[@]}"; do
+        args+=(--iio "$dev")
+    done
+    PYTHONUNBUFFERED=1 python3 install-modules/jetson-selftest.py --profile "$PROFILE" --duration "$DURATION" \
+        "${args[@]}" | grep -v '^Self-test:'
+    return "${PIPESTATUS[0]}"
+}
+
+failed=0
+read_imu || failed=1
+
+# Unreclaimable slab in kB: what leaks on error paths end up in
+slab_kb() {
+    awk '/^SUnreclaim:/ { print $2 }' /proc/meminfo
+}
+
+if [ ${#FAULTS[@]} -gt 0 ]; then
+    slab=$(slab_kb)
+    echo "Injecting faults: ${FAULTS[*]}"
+    kill -USR2 "$EMULATOR_PID"
+    read_imu
+    kill -USR2 "$EMULATOR_PID"
+    echo "Without faults again:"
+    read_imu || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the faults"
+fi
+
+# Unplugging is the emulator's exit, which destroys the uhid device
+if [ "$DISCONNECTS" -gt 0 ]; then
+    slab=$(slab_kb)
+    echo "Unplugging the IMU $DISCONNECTS times..."
+    for (( n = 1; n <= DISCONNECTS; n++ )); do
+        kill "$EMULATOR_PID"
+        wait "$EMULATOR_PID" 2>/dev/null
+        for (( i = 0; i < 500; i++ )); do
+            [ -e "/sys/bus/iio/devices/${devices[0]}" ] || break
+            sleep 0.01
+        done
+        start=$(date +%s%N)
+        start_emulator
+        if find_devices; then
+            echo "        $n: back at ${devices[*]} after $(( ($(date +%s%N) - start) / 1000000 )) ms"
+        else
+            echo "        $n: the IMU did not come back"
+            failed=1
+            break
+        fi
+    done
+    udevadm settle 2>/dev/null
+    read_imu || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the disconnects"
+fi
+
+[ $failed -eq 0 ] || { echo "Benchmark finished with failures"; exit 1; }
+echo "Benchmark finished"
@@ -0,0 +1,332 @@
+#!/bin/bash
+
+# Hardware-free probe and bring-up timing of the bundled modules
+#
+# Usage: probe-bench.sh [--modules DIR] [--iterations N] [--parallel]
+#                       [--keep DIR]
+#
+#   --modules DIR    load the .ko files of DIR instead of the installed
+#                    modules, e.g. install-modules
+#   --iterations N   unload and load the modules N times (default 10)
+#   --parallel       load independent modules in parallel, as
+#                    install-jetson-modules.sh does (default: one by one)
+#   --keep DIR       keep the raw timings and traces in DIR
+#
+# Connects an emulated D4xx camera and candleLight adapter through
+# dummy_hcd and an emulated D435i IMU through uhid (see uvc-bench.sh,
+# gs-usb-bench.sh and imu-bench.sh), then repeatedly unloads and loads
+# uvcvideo, gs_usb and the hid-sensor-* modules with the devices
+# present, as at boot. Reports the time of every modprobe, how long
+# after the first modprobe each device node appeared and, with the
+# function_graph tracer, how long uvc_probe, gs_usb_probe,
+# sensor_hub_probe and the IIO sensor probes took and which of their
+# phases the time went to: uvc_ctrl_init_device, uvc_video_init, chain
+# scanning and registration, USB control transfers and HID feature
+# reports. Medians, minimums and maximums over the iterations.
+#
+# Control transfers to the emulated devices are answered by processes
+# on the same machine, so their share is lower than with a real camera,
+# whose firmware takes milliseconds per request; compare the phases
+# before and after a change on one machine.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MODULES_DIR=""
+ITERATIONS=10
+PARALLEL=0
+KEEP=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --modules)
+            MODULES_DIR="$2"
+            [ -f "$MODULES_DIR/uvcvideo.ko" ] || { echo "Error: --modules needs a directory with the .ko files"; exit 1; }
+            shift
+            ;;
+        --iterations)
+            ITERATIONS="$2"
+            [[ "$ITERATIONS" =~ ^[1-9][0-9]*$ ]] || { echo "Error: --iterations needs a positive number"; exit 1; }
+            shift
+            ;;
+        --parallel) PARALLEL=1 ;;
+        --keep)
+            KEEP="$2"
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+for tool in d4xx-gadget gs-usb-gadget d4xx-imu; do
+    if [ ! -x "build/tools/$tool" ] || [ "tools/$tool.c" -nt "build/tools/$tool" ]; then
+        echo "Building $tool..."
+        mkdir -p build/tools
+        cc -O2 -Wall -pthread -o "build/tools/$tool" "tools/$tool.c" -lm ||
+            { echo "Failed to build $tool"; exit 1; }
+    fi
+done
+
+# The bundle, in dependency order
+MODULES=(uvcvideo gs_usb hid-sensor-hub hid-sensor-iio-common hid-sensor-trigger
+         hid-sensor-accel-3d hid-sensor-gyro-3d)
+
+# Dependencies with module names as in /sys/module
+module_deps() {
+    if [ -n "$MODULES_DIR" ]; then
+        modinfo -F depends "$MODULES_DIR/$1.ko"
+    else
+        modinfo -F depends "$1"
+    fi | tr ',-' ' _'
+}
+
+echo "Loading dummy_hcd, raw_gadget, FunctionFS, uhid and the modules' dependencies..."
+if [ "$(cat /sys/module/dummy_hcd/parameters/num 2>/dev/null || echo 0)" -lt 2 ]; then
+    modprobe -r dummy_hcd 2>/dev/null
+    modprobe dummy_hcd num=2 || { echo "Error: dummy_hcd is not available (CONFIG_USB_DUMMY_HCD)"; exit 1; }
+fi
+if [ "$(ls -d /sys/class/udc/dummy_udc.* 2>/dev/null | wc -l)" -lt 2 ]; then
+    echo "Error: dummy_hcd is in use with a single UDC; unload it first"
+    exit 1
+fi
+modprobe raw_gadget || { echo "Error: raw_gadget is not available (CONFIG_USB_RAW_GADGET)"; exit 1; }
+modprobe usb_f_fs || { echo "Error: FunctionFS is not available (CONFIG_USB_CONFIGFS_F_FS)"; exit 1; }
+modprobe uhid || { echo "Error: uhid is not available (CONFIG_UHID)"; exit 1; }
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+
+# Dependencies outside the bundle stay loaded: only the bundle is timed.
+# Levels as in install-jetson-modules.sh, for --parallel.
+declare -A LEVEL
+MAX_LEVEL=0
+for module in "${MODULES[@]}"; do
+    level=0
+    for dep in $(module_deps "$module"); do
+        if [ -n "${LEVEL[$dep]}" ]; then
+            (( LEVEL[$dep] + 1 > level )) && level=$(( LEVEL[$dep] + 1 ))
+        else
+            modprobe "$dep" || { echo "Failed to load $dep"; exit 1; }
+        fi
+    done
+    LEVEL[${module//-/_}]=$level
+    (( level > MAX_LEVEL )) && MAX_LEVEL=$level
+done
+
+unload_all() {
+    local i
+    for (( i = ${#MODULES[@]} - 1; i >= 0; i-- )); do
+        [ -d "/sys/module/${MODULES[$i]//-/_}" ] || continue
+        modprobe -r "${MODULES[$i]}" 2>/dev/null ||
+            { echo "Error: cannot unload ${MODULES[$i]} (in use?)"; return 1; }
+    done
+}
+
+# Loads one module and records how long modprobe took
+load_one() {
+    local start end
+    start=$(date +%s%N)
+    if [ -n "$MODULES_DIR" ]; then
+        insmod "$MODULES_DIR/$1.ko"
+    else
+        modprobe "$1"
+    fi || { echo "Failed to load $1"; return 1; }
+    end=$(date +%s%N)
+    echo "$2 $1 $(( (end - start) / 1000 ))" >> "$WORK/load"
+}
+
+WORK=$(mktemp -d)
+NAME="probe_bench"
+G="/sys/kernel/config/usb_gadget/$NAME"
+FFS="/run/$NAME"
+PIDS=()
+TRACING=""
+
+remove_gadget() {
+    rm -f "$G/configs/c.1/ffs.$NAME"
+    rmdir "$G/configs/c.1/strings/0x409" "$G/configs/c.1" "$G/functions/ffs.$NAME" \
+          "$G/strings/0x409" "$G" 2>/dev/null
+}
+
+cleanup() {
+    [ -n "$TRACING" ] && {
+        echo 0 > "$TRACING/tracing_on"
+        echo nop > "$TRACING/current_tracer"
+        echo > "$TRACING/set_ftrace_filter"
+    }
+    [ -e "$G/UDC" ] && echo "" > "$G/UDC" 2>/dev/null
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null && wait "$pid" 2>/dev/null
+    done
+    mountpoint -q "$FFS" && umount "$FFS"
+    rmdir "$FFS" 2>/dev/null
+    [ -d "$G" ] && remove_gadget
+    if [ -n "$KEEP" ]; then
+        mkdir -p "$KEEP" && cp -r "$WORK"/. "$KEEP"/
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+echo "Starting the emulated camera, CAN adapter and IMU..."
+unload_all || exit 1
+build/tools/d4xx-gadget -u dummy_udc -d dummy_udc.0 &
+PIDS+=($!)
+
+remove_gadget
+mkdir -p "$G/strings/0x409" "$G/configs/c.1/strings/0x409" "$G/functions/ffs.$NAME" ||
+    { echo "Error: cannot create the gadget (CONFIG_USB_LIBCOMPOSITE)"; exit 1; }
+echo 0x1d50 > "$G/idVendor"
+echo 0x606f > "$G/idProduct"
+echo 0x0200 > "$G/bcdUSB"
+echo "bytewerk" > "$G/strings/0x409/manufacturer"
+echo "candleLight USB to CAN adapter" > "$G/strings/0x409/product"
+echo "000000000001" > "$G/strings/0x409/serialnumber"
+echo "gs_usb" > "$G/configs/c.1/strings/0x409/configuration"
+ln -s "$G/functions/ffs.$NAME" "$G/configs/c.1/"
+mkdir -p "$FFS"
+mount -t functionfs "$NAME" "$FFS" || { echo "Error: cannot mount FunctionFS"; exit 1; }
+build/tools/gs-usb-gadget -c 1 "$FFS" &
+PIDS+=($!)
+for (( i = 0; i < 50; i++ )); do
+    [ -e "$FFS/ep2" ] && break
+    sleep 0.1
+done
+echo dummy_udc.1 > "$G/UDC" || { echo "Error: cannot bind the gadget to dummy_udc.1"; exit 1; }
+
+build/tools/d4xx-imu &
+PIDS+=($!)
+# Until the USB devices have enumerated and hid-generic has the IMU
+sleep 2
+udevadm settle 2>/dev/null
+
+# function_graph over the probe functions and the phases worth knowing.
+# ftrace keeps a filter on a module that is not loaded until it loads,
+# and drops it again when the module goes, so it is set before every
+# load. Functions of the kernel proper are filtered as they are.
+TRACE_FUNCTIONS=(
+    uvc_probe:mod:uvcvideo uvc_ctrl_init_device:mod:uvcvideo
+    uvc_scan_chain_entity:mod:uvcvideo uvc_mc_register_entities:mod:uvcvideo
+    uvc_register_video_device:mod:uvcvideo uvc_meta_register:mod:uvcvideo
+    uvc_video_init:mod:uvcvideo uvc_status_init:mod:uvcvideo uvc_query_ctrl:mod:uvcvideo
+    gs_usb_probe:mod:gs_usb
+    sensor_hub_probe:mod:hid_sensor_hub sensor_hub_get_feature:mod:hid_sensor_hub
+    sensor_hub_set_feature:mod:hid_sensor_hub
+    hid_sensor_parse_common_attributes:mod:hid_sensor_iio_common
+    hid_sensor_setup_trigger:mod:hid_sensor_trigger
+    hid_accel_3d_probe:mod:hid_sensor_accel_3d hid_gyro_3d_probe:mod:hid_sensor_gyro_3d
+    usb_control_msg hid_hw_start
+)
+
+set_filter() {
+    local spec
+    echo > "$TRACING/set_ftrace_filter"
+    for spec in "${TRACE_FUNCTIONS[@]}"; do
+        echo "$spec" >> "$TRACING/set_ftrace_filter" 2>/dev/null ||
+            [ -z "$1" ] || echo "Note: cannot trace ${spec%%:*}"
+    done
+}
+
+for dir in /sys/kernel/tracing /sys/kernel/debug/tracing; do
+    [ -e "$dir/available_tracers" ] && { TRACING="$dir"; break; }
+done
+if [ -z "$TRACING" ] && mount -t tracefs none /sys/kernel/tracing 2>/dev/null; then
+    TRACING=/sys/kernel/tracing
+fi
+if [ -n "$TRACING" ] && grep -qw function_graph "$TRACING/available_tracers"; then
+    echo 0 > "$TRACING/tracing_on"
+    echo nop > "$TRACING/current_tracer"
+    set_filter verbose
+fi
+# With the modules unloaded, a filter without usb_control_msg or
+# hid_hw_start would be empty, which traces every function
+if [ -n "$TRACING" ] && ! grep -q "all functions enabled" "$TRACING/set_ftrace_filter"; then
+    echo function_graph > "$TRACING/current_tracer"
+    echo 1 > "$TRACING/options/funcgraph-tail"
+    echo 1 > "$TRACING/options/funcgraph-proc"
+    echo 8192 > "$TRACING/buffer_size_kb"
+else
+    echo "Note: cannot trace the probes with function_graph (CONFIG_FUNCTION_GRAPH_TRACER), timing modprobe and devices only"
+    [ -n "$TRACING" ] && echo > "$TRACING/set_ftrace_filter"
+    TRACING=""
+fi
+
+# Records when the camera's capture node, the adapter's interface and
+# both IMU sensors appear, in microseconds
+watch_devices() {
+    local start="$1" out="$2" node seen=""
+    for (( i = 0; i < 1000; i++ )); do
+        if [[ "$seen" != *camera* ]]; then
+            for node in /sys/class/video4linux/video*; do
+                [ -e "$node" ] && [[ "$(readlink -f "$node/device")" == */dummy_hcd* ]] &&
+                    [ "$(cat "$node/index" 2>/dev/null)" = "0" ] && [ -e "/dev/${node##*/}" ] &&
+                    { echo "camera $(( ($(date +%s%N) - start) / 1000 ))" >> "$out"; seen+=" camera"; break; }
+            done
+        fi
+        if [[ "$seen" != *can* ]]; then
+            for node in /sys/class/net/can*; do
+                [ -e "$node" ] && [[ "$(readlink -f "$node/device")" == */dummy_hcd* ]] &&
+                    { echo "can $(( ($(date +%s%N) - start) / 1000 ))" >> "$out"; seen+=" can"; break; }
+            done
+        fi
+        if [[ "$seen" != *imu* ]] &&
+           [ "$(ls -d /sys/bus/iio/devices/iio:device* 2>/dev/null | while read -r node; do
+                  [[ "$(readlink -f "$node")" == */uhid/*HID-SENSOR-* ]] && echo "$node"; done | wc -l)" -ge 2 ]; then
+            echo "imu $(( ($(date +%s%N) - start) / 1000 ))" >> "$out"
+            seen+=" imu"
+        fi
+        [[ "$seen" == *camera*can*imu* ]] && return 0
+        sleep 0.01
+    done
+    return 1
+}
+
+echo "Loading the modules $ITERATIONS times$([ $PARALLEL -eq 1 ] && echo ", independent ones in parallel")..."
+for (( n = 1; n <= ITERATIONS; n++ )); do
+    unload_all || exit 1
+    sleep 0.5
+    if [ -n "$TRACING" ]; then
+        set_filter
+        echo > "$TRACING/trace"
+        echo 1 > "$TRACING/tracing_on"
+    fi
+    start=$(date +%s%N)
+    watch_devices "$start" "$WORK/ready.$n" &
+    watcher=$!
+    if [ $PARALLEL -eq 1 ]; then
+        for (( level = 0; level <= MAX_LEVEL; level++ )); do
+            loaders=()
+            for module in "${MODULES[@]}"; do
+                [ "${LEVEL[${module//-/_}]}" -eq "$level" ] || continue
+                load_one "$module" "$n" &
+                loaders+=($!)
+            done
+            for pid in "${loaders[@]}"; do
+                wait "$pid" || exit 1
+            done
+        done
+    else
+        for module in "${MODULES[@]}"; do
+            load_one "$module" "$n" || exit 1
+        done
+    fi
+    echo "$n total $(( ($(date +%s%N) - start) / 1000 ))" >> "$WORK/load"
+    wait "$watcher" || echo "        $n: not all devices appeared within 10 s"
+    if [ -n "$TRACING" ]; then
+        echo 0 > "$TRACING/tracing_on"
+        cat "$TRACING/trace" > "$WORK/trace.$n"
+    fi
+    echo "        $n: all devices up after $(( ($(date +%s%N) - start) / 1000000 )) ms"
+done
+
+python3 tools/probe-report.py "$WORK"
+echo "Benchmark finished"
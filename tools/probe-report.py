@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+
+# Report of a probe-bench.sh run
+#
+# Usage: probe-report.py WORK-DIR
+#
+# The directory holds "load" (iteration, module or "total", microseconds
+# of modprobe), ready.N (device, microseconds after the first modprobe
+# of iteration N) and, if the function_graph tracer was available,
+# trace.N with the funcgraph-proc and funcgraph-tail options. Prints the
+# median, minimum and maximum of every figure over the iterations. In
+# the probe breakdown phases nest as they were called, the time of a
+# phase includes the phases below it, and calls are per probe.
+
+import glob
+import os
+import re
+import statistics
+import sys
+from collections import defaultdict
+
+PROBES = ("uvc_probe", "gs_usb_probe", "sensor_hub_probe", "hid_accel_3d_probe", "hid_gyro_3d_probe")
+DEVICES = (("camera", "camera capture node"), ("can", "CAN interface"), ("imu", "both IMU sensors"))
+DURATION = re.compile(r"([\d.]+) us")
+NAME = re.compile(r"^(?:\} /\* )?([\w.]+)")
+
+
+def row(label, values, calls=None, indent=2):
+    values = [v / 1000.0 for v in values]
+    print("%-34s %8.2f %8.2f %8.2f%s"
+          % (" " * indent + label, statistics.median(values), min(values), max(values),
+             "  %6.1f" % calls if calls is not None else ""))
+
+
+def parse_trace(path):
+    """{probe: [(us, {phase path: [us, calls]})]} of one iteration"""
+    probes = defaultdict(list)
+    pending = defaultdict(list)
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.rstrip("\n").split("|")
+            if len(fields) != 3:
+                continue
+            m = DURATION.search(fields[1])
+            if not m:
+                continue
+            func = fields[2]
+            depth = (len(func) - len(func.lstrip()) - 2) // 2
+            name = NAME.match(func.strip())
+            if not name:
+                continue
+            name, us, pid = name.group(1), float(m.group(1)), fields[0].split()[-1]
+            if depth > 0:
+                pending[pid].append((depth, name, us))
+                continue
+            if name in PROBES:
+                # Calls end in post-order; backwards, callers come first
+                phases = defaultdict(lambda: [0.0, 0])
+                stack = []
+                for d, phase, t in reversed(pending[pid]):
+                    while stack and stack[-1][0] >= d:
+                        stack.pop()
+                    stack.append((d, phase))
+                    path = tuple(p for _, p in stack)
+                    phases[path][0] += t
+                    phases[path][1] += 1
+                probes[name].append((us, phases))
+            pending[pid] = []
+    return probes
+
+
+def print_phases(phases, parent):
+    children = [path for path in phases if path[:-1] == parent and len(path) == len(parent) + 1]
+    for path in sorted(children, key=lambda p: -statistics.median(phases[p][0])):
+        times, calls = phases[path]
+        row(path[-1], times, statistics.median(calls), 2 + 2 * len(path))
+        print_phases(phases, path)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("Usage: probe-report.py WORK-DIR")
+        return 1
+    d = sys.argv[1]
+
+    loads = defaultdict(list)
+    order = []
+    with open(os.path.join(d, "load")) as f:
+        for line in f:
+            _, module, us = line.split()
+            if module not in order:
+                order.append(module)
+            loads[module].append(int(us))
+    iterations = len(loads["total"])
+    print("%-34s %8s %8s %8s" % ("modprobe, ms", "median", "min", "max"))
+    for module in order:
+        if module != "total":
+            row(module, loads[module])
+    row("all modules", loads["total"])
+
+    ready = defaultdict(list)
+    for path in glob.glob(os.path.join(d, "ready.*")):
+        with open(path) as f:
+            for line in f:
+                device, us = line.split()
+                ready[device].append(int(us))
+    print("Devices up after the first modprobe, ms")
+    for device, label in DEVICES:
+        if ready[device]:
+            row(label, ready[device])
+        if len(ready[device]) < iterations:
+            print("    %s missing in %d of %d iterations" % (label, iterations - len(ready[device]), iterations))
+
+    traces = sorted(glob.glob(os.path.join(d, "trace.*")))
+    if not traces:
+        return 0
+    runs = [parse_trace(path) for path in traces]
+    print("%-34s %8s %8s %8s  %6s" % ("Probes, ms", "median", "min", "max", "calls"))
+    for probe in PROBES:
+        # Probes of one device per iteration; more than one call is summed
+        totals = [sum(us for us, _ in run[probe]) for run in runs if run[probe]]
+        if not totals:
+            print("  %-32s not traced" % probe)
+            continue
+        row(probe, totals)
+        phases = defaultdict(lambda: ([], []))
+        for run in runs:
+            if not run[probe]:
+                continue
+            merged = defaultdict(lambda: [0.0, 0])
+            for _, calls in run[probe]:
+                for key, (us, n) in calls.items():
+                    merged[key][0] += us
+                    merged[key][1] += n
+            for key, (us, n) in merged.items():
+                phases[key][0].append(us)
+                phases[key][1].append(n / len(run[probe]))
+        print_phases(phases, ())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,328 @@
+#!/bin/bash
+
+# Hardware-free scaling benchmark of cameras, IMUs and CAN adapters together
+#
+# Usage: scale-bench.sh [--scenario CAMERAS:IMUS:CANS]... [--size WxH]
+#                       [--fps N] [--imu-rate N] [--bitrate B]
+#                       [--duration SECONDS] [--keep DIR]
+#
+#   --scenario N:M:K  run N emulated cameras, M IMUs and K CAN adapters at
+#                     the same time (default: 1:1:1 2:1:1 2:2:2 4:2:2)
+#   --size WxH        Z16 frame size of every camera (default 848x480)
+#   --fps N           frame rate of every camera (default 30)
+#   --imu-rate N      samples per second of every IMU sensor (default 400)
+#   --bitrate B       bit rate of every CAN adapter (default 1000000)
+#   --duration S      seconds of every measurement (default 10)
+#   --keep DIR        keep the raw measurements of each scenario in DIR
+#
+# For each scenario, starts that many d4xx-gadget cameras and
+# gs-usb-gadget adapters, each on its own dummy_hcd UDC, and d4xx-imu
+# IMUs on uhid, then measures all of them at once with one
+# jetson-selftest.py per stream: camera fps, throughput and dequeue
+# latency, IMU sample rate and delivery latency, CAN frames per second
+# in loopback at the bus rate and echo latency, with p50/p99/max.
+# Meanwhile it samples the CPU time of every core and the interrupts
+# and softirqs per core. Ends with one line per scenario, so the point
+# where per-stream throughput or latency stops scaling with the device
+# count stands out.
+#
+# Everything runs on the same machine, including the device side, and
+# dummy_hcd completes transfers from a timer rather than an interrupt,
+# so the softirq distribution is where its work shows; on a Jetson with
+# real devices the xHCI interrupt lines appear instead. Use the figures
+# for comparisons on one machine.
+
+cd "$(dirname "$0")/.." || exit 1
+
+SCENARIOS=()
+SIZE="848x480"
+FPS=30
+IMU_RATE=400
+BITRATE=1000000
+DURATION=10
+KEEP=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --scenario)
+            [[ "$2" =~ ^[0-9]+:[0-9]+:[0-9]+$ ]] || { echo "Error: --scenario needs CAMERAS:IMUS:CANS"; exit 1; }
+            SCENARIOS+=("$2")
+            shift
+            ;;
+        --size)
+            SIZE="$2"
+            [[ "$SIZE" =~ ^[0-9]+x[0-9]+$ ]] || { echo "Error: --size needs WxH"; exit 1; }
+            shift
+            ;;
+        --fps)
+            FPS="$2"
+            shift
+            ;;
+        --imu-rate)
+            IMU_RATE="$2"
+            shift
+            ;;
+        --bitrate)
+            BITRATE="$2"
+            shift
+            ;;
+        --duration)
+            DURATION="$2"
+            shift
+            ;;
+        --keep)
+            KEEP="$2"
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+[ ${#SCENARIOS[@]} -gt 0 ] || SCENARIOS=(1:1:1 2:1:1 2:2:2 4:2:2)
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+# Every camera and every adapter needs a UDC of its own
+udcs=0
+for scenario in "${SCENARIOS[@]}"; do
+    IFS=: read -r n m k <<< "$scenario"
+    [ $(( n + k )) -gt "$udcs" ] && udcs=$(( n + k ))
+done
+if [ "$udcs" -gt 32 ]; then
+    echo "Error: dummy_hcd offers at most 32 UDCs, cameras plus CAN adapters are $udcs"
+    exit 1
+fi
+
+for tool in d4xx-gadget gs-usb-gadget d4xx-imu; do
+    if [ ! -x "build/tools/$tool" ] || [ "tools/$tool.c" -nt "build/tools/$tool" ]; then
+        echo "Building $tool..."
+        mkdir -p build/tools
+        cc -O2 -Wall -pthread -o "build/tools/$tool" "tools/$tool.c" -lm ||
+            { echo "Failed to build $tool"; exit 1; }
+    fi
+done
+
+echo "Loading dummy_hcd with $udcs UDCs, raw_gadget, FunctionFS, uhid and the drivers..."
+if [ "$(cat /sys/module/dummy_hcd/parameters/num 2>/dev/null || echo 0)" -lt "$udcs" ]; then
+    modprobe -r dummy_hcd 2>/dev/null
+    modprobe dummy_hcd num="$udcs" || { echo "Error: dummy_hcd is not available (CONFIG_USB_DUMMY_HCD)"; exit 1; }
+fi
+if [ "$(ls -d /sys/class/udc/dummy_udc.* 2>/dev/null | wc -l)" -lt "$udcs" ]; then
+    echo "Error: dummy_hcd is in use with fewer than $udcs UDCs; unload it first"
+    exit 1
+fi
+modprobe raw_gadget || { echo "Error: raw_gadget is not available (CONFIG_USB_RAW_GADGET)"; exit 1; }
+modprobe usb_f_fs || { echo "Error: FunctionFS is not available (CONFIG_USB_CONFIGFS_F_FS)"; exit 1; }
+modprobe uhid || { echo "Error: uhid is not available (CONFIG_UHID)"; exit 1; }
+for module in can_raw uvcvideo gs_usb hid-sensor-hub hid-sensor-accel-3d hid-sensor-gyro-3d; do
+    modprobe "$module" || { echo "Failed to load $module"; exit 1; }
+done
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+
+WORK=$(mktemp -d)
+PROFILE="$WORK/profile"
+PIDS=()
+ADAPTERS=()
+
+# One configfs gadget with a FunctionFS function per CAN adapter
+adapter_remove() {
+    local name="$1" g="/sys/kernel/config/usb_gadget/$1"
+    [ -e "$g/UDC" ] && echo "" > "$g/UDC" 2>/dev/null
+    if [ -d "$g" ]; then
+        rm -f "$g/configs/c.1/ffs.$name"
+        rmdir "$g/configs/c.1/strings/0x409" "$g/configs/c.1" "$g/functions/ffs.$name" \
+              "$g/strings/0x409" "$g" 2>/dev/null
+    fi
+}
+
+stop_devices() {
+    local name pid
+    for name in "${ADAPTERS[@]}"; do
+        [ -e "/sys/kernel/config/usb_gadget/$name/UDC" ] &&
+            echo "" > "/sys/kernel/config/usb_gadget/$name/UDC" 2>/dev/null
+    done
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null
+    done
+    for pid in "${PIDS[@]}"; do
+        wait "$pid" 2>/dev/null
+    done
+    for name in "${ADAPTERS[@]}"; do
+        mountpoint -q "/run/$name" && umount "/run/$name"
+        rmdir "/run/$name" 2>/dev/null
+        adapter_remove "$name"
+    done
+    PIDS=()
+    ADAPTERS=()
+}
+
+cleanup() {
+    stop_devices
+    if [ -n "$KEEP" ]; then
+        mkdir -p "$KEEP" && cp -r "$WORK"/. "$KEEP"/
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+adapter_add() {
+    local name="$1" udc="$2" g="/sys/kernel/config/usb_gadget/$1" i
+    adapter_remove "$name"
+    mkdir -p "$g/strings/0x409" "$g/configs/c.1/strings/0x409" "$g/functions/ffs.$name" ||
+        { echo "Error: cannot create the gadget (CONFIG_USB_LIBCOMPOSITE)"; return 1; }
+    ADAPTERS+=("$name")
+    echo 0x1d50 > "$g/idVendor"
+    echo 0x606f > "$g/idProduct"
+    echo 0x0200 > "$g/bcdUSB"
+    echo "bytewerk" > "$g/strings/0x409/manufacturer"
+    echo "candleLight USB to CAN adapter" > "$g/strings/0x409/product"
+    printf "%012d\n" "$(( ${udc##*.} + 1 ))" > "$g/strings/0x409/serialnumber"
+    echo "gs_usb" > "$g/configs/c.1/strings/0x409/configuration"
+    ln -s "$g/functions/ffs.$name" "$g/configs/c.1/"
+    mkdir -p "/run/$name"
+    mount -t functionfs "$name" "/run/$name" || { echo "Error: cannot mount FunctionFS"; return 1; }
+    build/tools/gs-usb-gadget -c 1 "/run/$name" &
+    PIDS+=($!)
+    for (( i = 0; i < 50; i++ )); do
+        [ -e "/run/$name/ep2" ] && break
+        sleep 0.1
+    done
+    echo "$udc" > "$g/UDC" || { echo "Error: cannot bind $name to $udc"; return 1; }
+}
+
+# The capture node of the camera on dummy_hcd.N, or the gs_usb interface
+# of the adapter there; the second video node of a camera is its
+# metadata node. Waits up to 10 s.
+find_on_hcd() {
+    local hcd="dummy_hcd.$2" node i
+    for (( i = 0; i < 1000; i++ )); do
+        if [ "$1" = "camera" ]; then
+            for node in /sys/class/video4linux/video*; do
+                [ -e "$node" ] || continue
+                [[ "$(readlink -f "$node/device")" == */$hcd/* ]] || continue
+                [ "$(cat "$node/index")" = "0" ] && [ -e "/dev/${node##*/}" ] &&
+                    { echo "/dev/${node##*/}"; return 0; }
+            done
+        else
+            for node in /sys/class/net/can*; do
+                [ -e "$node" ] || continue
+                [[ "$(readlink -f "$node/device")" == */$hcd/* ]] && { echo "${node##*/}"; return 0; }
+            done
+        fi
+        sleep 0.01
+    done
+    return 1
+}
+
+# The IIO devices of all emulated IMUs, two per IMU
+find_iio() {
+    local dev i
+    for (( i = 0; i < 1000; i++ )); do
+        iio=()
+        for dev in /sys/bus/iio/devices/iio:device*; do
+            [ -e "$dev" ] || continue
+            [[ "$(readlink -f "$dev")" == */uhid/*HID-SENSOR-* ]] && iio+=("${dev##*/}")
+        done
+        [ ${#iio[@]} -ge $(( 2 * $1 )) ] && return 0
+        sleep 0.01
+    done
+    return 1
+}
+
+# Streams are measured, not judged: no thresholds but the CAN burst,
+# sized to last the whole duration at about 8000 frames/s of 1 Mbit/s
+{
+    echo "selftest uvc-min-fps 0"
+    echo "selftest uvc-max-drop-pct 100"
+    echo "selftest uvc-max-latency-ms 1000"
+    echo "selftest imu-max-loss-pct 100"
+    echo "selftest imu-max-latency-ms 1000"
+    echo "selftest can-bitrate $BITRATE"
+    echo "selftest can-frames $(awk -v b="$BITRATE" -v d="$DURATION" 'BEGIN { printf "%d", b / 125 * d }')"
+    echo "selftest can-min-fps 0"
+    echo "selftest can-max-echo-us 1000000"
+} > "$PROFILE"
+
+run_scenario() {
+    local cameras="$1" imus="$2" cans="$3" dir="$WORK/$1-$2-$3" i dev
+    local streams=() names=() pids=()
+    mkdir -p "$dir"
+    echo "$cameras $imus $cans" > "$dir/scenario"
+
+    for (( i = 0; i < cameras; i++ )); do
+        build/tools/d4xx-gadget -W "${SIZE%x*}" -H "${SIZE#*x}" -r "$FPS" -u dummy_udc -d "dummy_udc.$i" &
+        PIDS+=($!)
+    done
+    for (( i = 0; i < cans; i++ )); do
+        adapter_add "scale_can$i" "dummy_udc.$(( cameras + i ))" || return 1
+    done
+    for (( i = 0; i < imus; i++ )); do
+        build/tools/d4xx-imu -r "$IMU_RATE" &
+        PIDS+=($!)
+    done
+
+    for (( i = 0; i < cameras; i++ )); do
+        dev=$(find_on_hcd camera "$i") || { echo "Error: camera $i did not appear"; return 1; }
+        streams+=("--device $dev --format Z16:$SIZE")
+        names+=("${dev##*/}")
+    done
+    for (( i = 0; i < cans; i++ )); do
+        dev=$(find_on_hcd can $(( cameras + i ))) || { echo "Error: CAN adapter $i did not appear"; return 1; }
+        streams+=("--can $dev")
+        names+=("$dev")
+    done
+    if [ "$imus" -gt 0 ]; then
+        find_iio "$imus" || { echo "Error: only ${#iio[@]} of $(( 2 * imus )) IMU sensors appeared"; return 1; }
+        for dev in "${iio[@]}"; do
+            streams+=("--iio $dev")
+            names+=("${dev#iio:}")
+        done
+    fi
+    udevadm settle 2>/dev/null
+
+    echo "Scenario $cameras cameras, $imus IMUs, $cans CAN adapters: ${#streams[@]} streams for $DURATION s..."
+    cat /proc/stat > "$dir/stat.before"
+    cat /proc/interrupts > "$dir/interrupts.before"
+    cat /proc/softirqs > "$dir/softirqs.before"
+    for i in "${!streams[@]}"; do
+        # shellcheck disable=SC2086
+        python3 install-modules/jetson-selftest.py --profile "$PROFILE" --duration "$DURATION" \
+            ${streams[$i]} --json "$dir/${names[$i]}.json" > "$dir/${names[$i]}.log" 2>&1 &
+        pids+=($!)
+    done
+    # The CAN bursts may outlast the other streams; sample the window
+    # that they all share
+    sleep "$DURATION"
+    cat /proc/stat > "$dir/stat.after"
+    cat /proc/interrupts > "$dir/interrupts.after"
+    cat /proc/softirqs > "$dir/softirqs.after"
+    for i in "${pids[@]}"; do
+        wait "$i"
+    done
+
+    python3 tools/scale-report.py "$dir"
+    stop_devices
+}
+
+for scenario in "${SCENARIOS[@]}"; do
+    IFS=: read -r n m k <<< "$scenario"
+    run_scenario "$n" "$m" "$k" || stop_devices
+    echo
+done
+
+echo "Scaling, $SIZE Z16 at $FPS fps per camera, $IMU_RATE samples/s per IMU sensor, $BITRATE bit/s per adapter:"
+dirs=()
+for scenario in "${SCENARIOS[@]}"; do
+    dirs+=("$WORK/${scenario//:/-}")
+done
+python3 tools/scale-report.py --table "${dirs[@]}"
+echo "Benchmark finished"
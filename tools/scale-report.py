@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+
+# Report of one scale-bench.sh scenario, or the table of all of them
+#
+# Usage: scale-report.py SCENARIO-DIR
+#        scale-report.py --table SCENARIO-DIR...
+#
+# A scenario directory holds the jetson-selftest.py --json output of
+# every device (*.json), the scenario as "cameras imus cans" in
+# "scenario", and /proc/stat, /proc/interrupts and /proc/softirqs from
+# before and after the measurement (*.before, *.after). The first form
+# prints every stream, the CPU time of each core and where interrupts
+# and softirqs ran, and saves the totals to summary.json for the table.
+
+import glob
+import json
+import os
+import sys
+
+# Columns of the cpuN lines of /proc/stat
+CPU_FIELDS = ("user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal")
+SOFTIRQS = ("HI", "TIMER", "NET_RX", "TASKLET", "HRTIMER")
+
+
+def read_cpu_stat(path):
+    cpus = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if fields[0].startswith("cpu") and fields[0] != "cpu":
+                cpus[fields[0]] = dict(zip(CPU_FIELDS, map(int, fields[1:9])))
+    return cpus
+
+
+def read_per_cpu_table(path):
+    """/proc/interrupts or /proc/softirqs: {name: [count per CPU]}"""
+    with open(path) as f:
+        ncpus = len(f.readline().split())
+        rows = {}
+        for line in f:
+            name, _, rest = line.partition(":")
+            fields = rest.split()
+            counts = [int(x) for x in fields[:ncpus] if x.isdigit()]
+            if len(counts) < ncpus:
+                continue
+            label = " ".join(fields[ncpus:])
+            rows[name.strip()] = (counts, label)
+    return rows
+
+
+def cpu_usage(d):
+    before = read_cpu_stat(os.path.join(d, "stat.before"))
+    after = read_cpu_stat(os.path.join(d, "stat.after"))
+    usage = []
+    for cpu in sorted(after, key=lambda c: int(c[3:])):
+        if cpu not in before:
+            continue
+        delta = {k: after[cpu][k] - before[cpu][k] for k in CPU_FIELDS}
+        total = sum(delta.values()) or 1
+        usage.append((cpu, {k: 100.0 * v / total for k, v in delta.items()}))
+    return usage
+
+
+def deltas(d, name):
+    before = read_per_cpu_table(os.path.join(d, name + ".before"))
+    after = read_per_cpu_table(os.path.join(d, name + ".after"))
+    rows = []
+    for key, (counts, label) in after.items():
+        old = before.get(key, ([0] * len(counts), label))[0]
+        diff = [a - b for a, b in zip(counts, old)]
+        if sum(diff) > 0:
+            rows.append((key, label, diff))
+    rows.sort(key=lambda r: -sum(r[2]))
+    return rows
+
+
+def distribution(counts):
+    total = sum(counts)
+    return " ".join("%3.0f%%" % (100.0 * c / total) for c in counts)
+
+
+def fmt(value, spec):
+    return spec % value if value is not None else "-"
+
+
+def report(d):
+    with open(os.path.join(d, "scenario")) as f:
+        cameras, imus, cans = map(int, f.read().split())
+    results = []
+    for path in sorted(glob.glob(os.path.join(d, "*.json"))):
+        if os.path.basename(path) != "summary.json":
+            with open(path) as f:
+                results.extend(json.load(f))
+
+    uvc = [r for r in results if r["kind"] == "uvc"]
+    iio = [r for r in results if r["kind"] == "iio"]
+    can = [r for r in results if r["kind"] == "can"]
+    for r in uvc:
+        print("  %-14s %6.2f fps %7.1f MB/s  %d dropped, %d errors  latency p50 %s p99 %s max %s ms"
+              % (r["device"], r["fps"], r["mb_s"], r["dropped"], r["errors"],
+                 fmt(r["lat_p50"], "%.2f"), fmt(r["lat_p99"], "%.2f"), fmt(r["lat_max"], "%.2f")))
+    for r in iio:
+        print("  %-14s %6.1f samples/s  %d lost  latency p50 %s p99 %s max %s ms"
+              % (r["device"], r["rate"], r["lost"],
+                 fmt(r["lat_p50"], "%.2f"), fmt(r["lat_p99"], "%.2f"), fmt(r["lat_max"], "%.2f")))
+    for r in can:
+        print("  %-14s %6.0f frames/s  %d/%d echoed  echo p50 %s p99 %s max %s us"
+              % (r["device"], r["fps"], r["echoes"], r["sent"],
+                 fmt(r["echo_p50"], "%.0f"), fmt(r["echo_p99"], "%.0f"), fmt(r["echo_max"], "%.0f")))
+    missing = cameras + 2 * imus + cans - len(results)
+    if missing > 0:
+        print("  %d stream(s) failed, see the self-test output in %s" % (missing, d))
+
+    usage = cpu_usage(d)
+    print("  CPU per core, %:     user  system  irq  softirq  busy")
+    busy = []
+    for cpu, u in usage:
+        b = 100.0 - u["idle"] - u["iowait"]
+        busy.append(b)
+        print("    %-6s           %5.1f  %6.1f  %3.1f  %7.1f  %4.1f"
+              % (cpu, u["user"] + u["nice"], u["system"], u["irq"], u["softirq"], b))
+
+    irqs = deltas(d, "interrupts")
+    if irqs:
+        print("  Interrupts per core (share of each source):")
+        for key, label, diff in irqs[:8]:
+            print("    %-5s %9d  %s  %s" % (key, sum(diff), distribution(diff), label))
+    softirqs = [r for r in deltas(d, "softirqs") if r[0] in SOFTIRQS]
+    if softirqs:
+        print("  Softirqs per core:")
+        for key, _, diff in softirqs:
+            print("    %-8s %9d  %s" % (key, sum(diff), distribution(diff)))
+
+    def worst(rows, key, pick=max):
+        values = [r[key] for r in rows if r.get(key) is not None]
+        return pick(values) if values else None
+
+    summary = {
+        "scenario": [cameras, imus, cans],
+        "failed": max(missing, 0),
+        "cam_mb_s": sum(r["mb_s"] for r in uvc),
+        "cam_fps_min": worst(uvc, "fps", min),
+        "cam_p99": worst(uvc, "lat_p99"),
+        "imu_rate_min": worst(iio, "rate", min),
+        "imu_p99": worst(iio, "lat_p99"),
+        "can_fps_min": worst(can, "fps", min),
+        "can_p99": worst(can, "echo_p99"),
+        "cpu_avg": sum(busy) / len(busy) if busy else None,
+        "cpu_max": max(busy) if busy else None,
+    }
+    with open(os.path.join(d, "summary.json"), "w") as f:
+        json.dump(summary, f)
+
+
+def table(dirs):
+    rows = []
+    for d in dirs:
+        try:
+            with open(os.path.join(d, "summary.json")) as f:
+                rows.append(json.load(f))
+        except OSError:
+            continue
+    print("cam imu can | cam MB/s  per cam  vs first  min fps  p99 ms | imu min/s  p99 ms"
+          " | can min fps  p99 us | CPU avg  busiest | failed")
+    first = None
+    for s in rows:
+        cameras, imus, cans = s["scenario"]
+        per_cam = s["cam_mb_s"] / cameras if cameras else None
+        if first is None and per_cam:
+            first = per_cam
+        print("%3d %3d %3d | %8.1f  %7s  %8s  %7s  %6s | %9s  %6s | %11s  %6s | %6s%%  %6s%% | %d"
+              % (cameras, imus, cans, s["cam_mb_s"], fmt(per_cam, "%.1f"),
+                 fmt(100.0 * per_cam / first if per_cam and first else None, "%.0f%%"),
+                 fmt(s["cam_fps_min"], "%.2f"), fmt(s["cam_p99"], "%.2f"),
+                 fmt(s["imu_rate_min"], "%.1f"), fmt(s["imu_p99"], "%.2f"),
+                 fmt(s["can_fps_min"], "%.0f"), fmt(s["can_p99"], "%.0f"),
+                 fmt(s["cpu_avg"], "%.1f"), fmt(s["cpu_max"], "%.1f"), s["failed"]))
+
+
+def main():
+    if len(sys.argv) > 2 and sys.argv[1] == "--table":
+        table(sys.argv[2:])
+    elif len(sys.argv) == 2:
+        report(sys.argv[1])
+    else:
+        print("Usage: scale-report.py SCENARIO-DIR | --table SCENARIO-DIR...")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,210 @@
+#!/bin/bash
+
+# Hardware-free uvcvideo streaming benchmark
+#
+# Usage: uvc-bench.sh [--module uvcvideo.ko] [--super] [--size WxH]
+#                     [--fps N] [--duration SECONDS] [--format FOURCC]...
+#                     [--fault NAME:FRACTION]... [--disconnects N]
+#
+#   --module FILE   load this uvcvideo.ko instead of the installed one
+#   --super         connect at SuperSpeed (default: high speed)
+#   --size WxH      frame size of every format (default 848x480)
+#   --fps N         frame rate (default 30)
+#   --duration S    seconds streamed per format (default 10)
+#   --format F      stream only these formats (default: Z16 Y8I Y12I YUYV)
+#   --fault F:P     then stream the first format with fault F injected into
+#                   fraction P of the payloads (short, header, overflow,
+#                   stall), and once more without faults
+#   --disconnects N then unplug and replug the camera N times
+#
+# Loads dummy_hcd and raw_gadget, starts the emulated D4xx camera of
+# d4xx-gadget.c (compiled on first use) and streams every format through
+# uvcvideo with jetson-selftest.py, which reports fps, drops, latency,
+# throughput, kernel CPU per frame and uvcvideo's own counters. The
+# camera side runs on the same machine, so CPU figures include it; they
+# are for before/after comparisons on one machine. With faults or
+# disconnects it also reports how long the camera took to come back and
+# how much unreclaimable slab memory the kernel gained meanwhile.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MODULE=""
+SPEED="high"
+SIZE="848x480"
+FPS=30
+DURATION=10
+FORMATS=()
+FAULTS=()
+DISCONNECTS=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --module)
+            MODULE="$2"
+            [ -f "$MODULE" ] || { echo "Error: --module needs a uvcvideo.ko file"; exit 1; }
+            shift
+            ;;
+        --super) SPEED="super" ;;
+        --size)
+            SIZE="$2"
+            [[ "$SIZE" =~ ^[0-9]+x[0-9]+$ ]] || { echo "Error: --size needs WxH"; exit 1; }
+            shift
+            ;;
+        --fps)
+            FPS="$2"
+            shift
+            ;;
+        --duration)
+            DURATION="$2"
+            shift
+            ;;
+        --format)
+            FORMATS+=("$2")
+            shift
+            ;;
+        --fault)
+            [[ "$2" =~ ^[a-z]+:[0-9.]+$ ]] || { echo "Error: --fault needs NAME:FRACTION"; exit 1; }
+            FAULTS+=("$2")
+            shift
+            ;;
+        --disconnects)
+            DISCONNECTS="$2"
+            shift
+            ;;
+        -h|--help)
+            sed -n '3,/^$/p' "$0" | sed 's/^# \{0,1\}//'
+            exit 0
+            ;;
+        *)
+            echo "Error: unknown option $1"
+            exit 1
+            ;;
+    esac
+    shift
+done
+[ ${#FORMATS[@]} -gt 0 ] || FORMATS=(Z16 Y8I Y12I YUYV)
+
+if [ "$EUID" -ne 0 ]; then
+    echo "Error: This script must be run as root (sudo)"
+    exit 1
+fi
+
+GADGET="build/tools/d4xx-gadget"
+if [ ! -x "$GADGET" ] || [ tools/d4xx-gadget.c -nt "$GADGET" ]; then
+    echo "Building d4xx-gadget..."
+    mkdir -p build/tools
+    cc -O2 -Wall -pthread -o "$GADGET" tools/d4xx-gadget.c || { echo "Failed to build d4xx-gadget"; exit 1; }
+fi
+
+echo "Loading dummy_hcd and raw_gadget..."
+if [ "$SPEED" = "super" ]; then
+    modprobe dummy_hcd is_super_speed=1
+else
+    modprobe dummy_hcd
+fi || { echo "Error: dummy_hcd is not available (CONFIG_USB_DUMMY_HCD)"; exit 1; }
+modprobe raw_gadget || { echo "Error: raw_gadget is not available (CONFIG_USB_RAW_GADGET)"; exit 1; }
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+
+if [ -n "$MODULE" ]; then
+    echo "Loading $MODULE..."
+    modprobe -r uvcvideo 2>/dev/null
+    for dep in $(modinfo -F depends "$MODULE" | tr ',' ' '); do
+        modprobe "$dep" || { echo "Failed to load $dep"; exit 1; }
+    done
+    insmod "$MODULE" || { echo "Failed to load $MODULE"; exit 1; }
+fi
+
+GADGET_PID=""
+PROFILE=$(mktemp)
+trap '[ -n "$GADGET_PID" ] && kill "$GADGET_PID" 2>/dev/null; rm -f "$PROFILE"' EXIT
+
+fault_args=()
+for fault in "${FAULTS[@]}"; do
+    fault_args+=(-f "$fault")
+done
+"$GADGET" -s "$SPEED" -W "${SIZE%x*}" -H "${SIZE#*x}" -r "$FPS" "${fault_args[@]}" &
+GADGET_PID=$!
+
+# The capture node is the camera's first video device; the second one
+# is its metadata node. Waits up to 10 s for it.
+find_camera() {
+    local node i
+    device=""
+    for (( i = 0; i < 1000; i++ )); do
+        for node in /sys/class/video4linux/video*; do
+            [ -e "$node" ] || continue
+            [[ "$(readlink -f "$node/device")" == */dummy_hcd* ]] || continue
+            [ "$(cat "$node/index")" = "0" ] && device="/dev/${node##*/}"
+        done
+        [ -n "$device" ] && [ -e "$device" ] && return 0
+        kill -0 "$GADGET_PID" 2>/dev/null || { echo "Error: d4xx-gadget exited"; exit 1; }
+        sleep 0.01
+    done
+    return 1
+}
+
+find_camera || { echo "Error: the emulated camera did not appear"; exit 1; }
+udevadm settle 2>/dev/null
+echo "Emulated camera at $device, $SIZE at $FPS fps, $SPEED speed"
+
+# Everything slower than 90% of the requested rate counts as a failure
+{
+    echo "selftest uvc-min-fps $(awk -v fps="$FPS" 'BEGIN { print fps * 0.9 }')"
+    echo "selftest uvc-max-drop-pct 0"
+} > "$PROFILE"
+
+failed=0
+for format in "${FORMATS[@]}"; do
+    PYTHONUNBUFFERED=1 python3 install-modules/jetson-selftest.py --profile "$PROFILE" --duration "$DURATION" \
+        --device "$device" --format "$format:$SIZE" | grep -v '^Self-test:'
+    [ "${PIPESTATUS[0]}" -eq 0 ] || failed=1
+done
+
+# Unreclaimable slab in kB: what leaks on error paths end up in
+slab_kb() {
+    awk '/^SUnreclaim:/ { print $2 }' /proc/meminfo
+}
+
+stream_once() {
+    PYTHONUNBUFFERED=1 python3 install-modules/jetson-selftest.py --profile "$PROFILE" --duration "$DURATION" \
+        --device "$device" --format "${FORMATS[0]}:$SIZE" | grep -v '^Self-test:'
+    return "${PIPESTATUS[0]}"
+}
+
+if [ ${#FAULTS[@]} -gt 0 ]; then
+    slab=$(slab_kb)
+    echo "Injecting faults: ${FAULTS[*]}"
+    kill -USR2 "$GADGET_PID"
+    stream_once
+    kill -USR2 "$GADGET_PID"
+    echo "Without faults again:"
+    stream_once || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the faults"
+fi
+
+if [ "$DISCONNECTS" -gt 0 ]; then
+    udc=$(basename "$(ls -d /sys/class/udc/dummy_udc.* | head -n 1)")
+    slab=$(slab_kb)
+    echo "Unplugging the camera $DISCONNECTS times..."
+    for (( n = 1; n <= DISCONNECTS; n++ )); do
+        echo disconnect > "/sys/class/udc/$udc/soft_connect"
+        for (( i = 0; i < 500; i++ )); do
+            [ -e "$device" ] || break
+            sleep 0.01
+        done
+        start=$(date +%s%N)
+        echo connect > "/sys/class/udc/$udc/soft_connect"
+        if find_camera; then
+            echo "        $n: back at $device after $(( ($(date +%s%N) - start) / 1000000 )) ms"
+        else
+            echo "        $n: the camera did not come back"
+            failed=1
+            break
+        fi
+    done
+    udevadm settle 2>/dev/null
+    stream_once || failed=1
+    echo "        slab: $(( $(slab_kb) - slab )) kB more than before the disconnects"
+fi
+
+[ $failed -eq 0 ] || { echo "Benchmark finished with failures"; exit 1; }
+echo "Benchmark finished"
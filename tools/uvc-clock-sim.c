@@ -0,0 +1,302 @@
+/*
+ * Simulate UVC hardware timestamp recovery against synthetic clocks
+ *
+ * Generates a camera stream on a simulated timeline: a device clock with
+ * a given frequency, drift and start value, the 1 kHz USB SOF counter,
+ * payloads with SCR fields latched by the device and decoded by the host
+ * after a delay with jitter, some of them lost. The samples go through a
+ * userspace copy of uvcvideo's clock recovery (uvc_video_clock_decode,
+ * uvc_video_clock_host_sof and uvc_video_clock_update, as of Linux
+ * 5.15), and every recovered frame timestamp is compared with the host
+ * time at which the frame's PTS was taken. The driver sources are not
+ * part of this repository, so the clock code is a transcription; keep it
+ * in step with the uvc_video.c the modules are built from.
+ *
+ * Reports the timestamp error distribution and the cost of one
+ * uvc_video_clock_update call. Runs longer than 2.048 s cross the SOF
+ * wraparound; a start value close to 2^32 (-c 0xfff00000) tests the
+ * device clock wraparound.
+ *
+ * Usage: uvc-clock-sim [-f clock-hz] [-d drift-ppm] [-c start] [-r fps]
+ *                      [-t seconds] [-p payloads] [-l latency-us]
+ *                      [-j jitter-us] [-x drop-pct] [-o sof-offset]
+ *                      [-S seed]
+ *
+ * Build: cc -O2 -o uvc-clock-sim uvc-clock-sim.c -lm
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC    1000000000LL
+#define NSEC_PER_MSEC   1000000LL
+
+#define UVC_STREAM_SCR  (1 << 3)
+#define UVC_STREAM_PTS  (1 << 2)
+
+#define UVC_CLOCK_SAMPLES 32
+
+struct uvc_clock_sample {
+	uint32_t dev_stc;
+	uint16_t dev_sof;
+	uint16_t host_sof;
+	int64_t host_time;
+};
+
+struct uvc_clock {
+	struct uvc_clock_sample samples[UVC_CLOCK_SAMPLES];
+	unsigned int head;
+	unsigned int count;
+	unsigned int size;
+	uint16_t last_sof;
+	uint16_t sof_offset;
+};
+
+/* uvc_video_clock_decode(), with the host SOF and time passed in */
+static void clock_decode(struct uvc_clock *clock, const uint8_t *data, int len,
+			 uint16_t host_sof, int64_t time)
+{
+	struct uvc_clock_sample *sample;
+	unsigned int header_size;
+	uint16_t dev_sof;
+
+	if (!(data[1] & UVC_STREAM_SCR))
+		return;
+	header_size = data[1] & UVC_STREAM_PTS ? 12 : 8;
+	if (len < (int)header_size)
+		return;
+
+	/* To limit the amount of data, drop SCRs with an SOF identical to
+	 * the previous one */
+	dev_sof = data[header_size - 2] | data[header_size - 1] << 8;
+	if (dev_sof == clock->last_sof)
+		return;
+	clock->last_sof = dev_sof;
+
+	/* Estimate the offset of devices that keep their own frame counter
+	 * the first time a SOF is received, ignoring differences up to 10 ms
+	 * that come from transmission delays */
+	if (clock->sof_offset == (uint16_t)-1) {
+		uint16_t delta_sof = (host_sof - dev_sof) & 255;
+
+		clock->sof_offset = delta_sof >= 10 ? delta_sof : 0;
+	}
+	dev_sof = (dev_sof + clock->sof_offset) & 2047;
+
+	sample = &clock->samples[clock->head];
+	memcpy(&sample->dev_stc, &data[header_size - 6], 4);
+	sample->dev_sof = dev_sof;
+	sample->host_sof = host_sof;
+	sample->host_time = time;
+
+	/* Update the sliding window head and count */
+	clock->head = (clock->head + 1) % clock->size;
+	if (clock->count < clock->size)
+		clock->count++;
+}
+
+static uint16_t clock_host_sof(const struct uvc_clock_sample *sample)
+{
+	/* The delta value can be negative */
+	int8_t delta_sof;
+
+	delta_sof = (sample->host_sof - sample->dev_sof) & 255;
+	return (sample->dev_sof + delta_sof) & 2047;
+}
+
+/* uvc_video_clock_update(): the host time of a PTS, or -1 while the
+ * sample window is not full yet */
+static int64_t clock_update(const struct uvc_clock *clock, uint32_t pts)
+{
+	const struct uvc_clock_sample *first, *last;
+	uint32_t delta_stc, y1, y2, x1, x2, mean, sof;
+	uint64_t y;
+
+	if (clock->count < clock->size)
+		return -1;
+
+	first = &clock->samples[clock->head];
+	last = &clock->samples[(clock->head - 1 + clock->size) % clock->size];
+
+	/* First step, PTS to SOF conversion */
+	delta_stc = pts - (1UL << 31);
+	x1 = first->dev_stc - delta_stc;
+	x2 = last->dev_stc - delta_stc;
+	if (x1 == x2)
+		return -1;
+
+	y1 = (first->dev_sof + 2048) << 16;
+	y2 = (last->dev_sof + 2048) << 16;
+	if (y2 < y1)
+		y2 += 2048 << 16;
+
+	y = (uint64_t)(y2 - y1) * (1ULL << 31) + (uint64_t)y1 * (uint64_t)x2
+	  - (uint64_t)y2 * (uint64_t)x1;
+	y = y / (x2 - x1);
+	sof = y;
+
+	/* Second step, SOF to host clock conversion */
+	x1 = (clock_host_sof(first) + 2048) << 16;
+	x2 = (clock_host_sof(last) + 2048) << 16;
+	if (x2 < x1)
+		x2 += 2048 << 16;
+	if (x1 == x2)
+		return -1;
+
+	y1 = NSEC_PER_SEC;
+	y2 = (uint32_t)(last->host_time - first->host_time) + y1;
+
+	/* Interpolated and host SOF timestamps can wrap around at slightly
+	 * different times; keep the computed SOF close to the samples' mean */
+	mean = (x1 + x2) / 2;
+	if (mean - (1024 << 16) > sof)
+		sof += 2048 << 16;
+	else if (sof > mean + (1024 << 16))
+		sof -= 2048 << 16;
+
+	y = (uint64_t)(y2 - y1) * (uint64_t)sof + (uint64_t)y1 * (uint64_t)x2
+	  - (uint64_t)y2 * (uint64_t)x1;
+	y = y / (x2 - x1);
+
+	return first->host_time + y - y1;
+}
+
+static uint64_t rng_state = 1;
+
+static double rnd(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-f clock-hz] [-d drift-ppm] [-c start] [-r fps] [-t seconds]\n"
+		"       [-p payloads] [-l latency-us] [-j jitter-us] [-x drop-pct] [-o sof-offset] "
+		"[-S seed]\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	double freq = 1000000, drift = 0, fps = 30, seconds = 60, latency = 125, jitter = 100, drop = 0;
+	unsigned int payloads = 20, sof_offset = 0, skipped = 0, n = 0, frames, f, i;
+	uint32_t stc0 = 0;
+	struct uvc_clock clock;
+	double *err, sum = 0, sq = 0, mean;
+	uint64_t cost = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:d:c:r:t:p:l:j:x:o:S:")) != -1) {
+		switch (opt) {
+		case 'f': freq = atof(optarg); break;
+		case 'd': drift = atof(optarg); break;
+		case 'c': stc0 = strtoul(optarg, NULL, 0); break;
+		case 'r': fps = atof(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'p': payloads = strtoul(optarg, NULL, 0); break;
+		case 'l': latency = atof(optarg); break;
+		case 'j': jitter = atof(optarg); break;
+		case 'x': drop = atof(optarg); break;
+		case 'o': sof_offset = strtoul(optarg, NULL, 0) & 2047; break;
+		case 'S': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	/* Less than one frame in -t seconds leaves nothing to measure */
+	if (optind != argc || freq <= 0 || fps <= 0 || seconds <= 0 || payloads == 0 ||
+	    (frames = seconds * fps) == 0)
+		usage(argv[0]);
+
+	err = malloc(frames * sizeof(*err));
+	if (!err) {
+		perror("malloc");
+		return 1;
+	}
+	memset(&clock, 0, sizeof(clock));
+	clock.size = UVC_CLOCK_SAMPLES;
+	clock.last_sof = -1;
+	clock.sof_offset = -1;
+
+	/*
+	 * Host time is the simulation's time base; the host starts at 5 s so
+	 * that host_time stays positive, the SOF counter ticks every
+	 * millisecond of it and the device clock runs drift ppm fast.
+	 * Payloads of a frame leave the device evenly spread over the frame
+	 * interval, after the frame's PTS was latched, and reach the decoder
+	 * latency plus up to jitter microseconds later.
+	 */
+	for (f = 0; f < frames; f++) {
+		int64_t capture = 5 * NSEC_PER_SEC + f * NSEC_PER_SEC / fps;
+		uint32_t pts = stc0 + (uint64_t)llround(capture * freq * (1 + drift * 1e-6) / NSEC_PER_SEC);
+		uint64_t start;
+		int64_t ts;
+
+		for (i = 0; i < payloads; i++) {
+			int64_t sent = capture + (int64_t)(i * NSEC_PER_SEC / fps / payloads);
+			int64_t host = sent + (int64_t)((latency + rnd() * jitter) * 1000);
+			uint32_t stc = stc0 + (uint64_t)llround(sent * freq * (1 + drift * 1e-6) / NSEC_PER_SEC);
+			uint16_t dev_sof = (sent / NSEC_PER_MSEC - sof_offset) & 2047;
+			uint8_t header[12] = { 12, UVC_STREAM_PTS | UVC_STREAM_SCR };
+
+			if (rnd() * 100 < drop)
+				continue;
+			memcpy(&header[2], &pts, 4);
+			memcpy(&header[6], &stc, 4);
+			header[10] = dev_sof & 0xff;
+			header[11] = dev_sof >> 8;
+			clock_decode(&clock, header, sizeof(header), (host / NSEC_PER_MSEC) & 2047, host);
+		}
+
+		start = now_ns();
+		ts = clock_update(&clock, pts);
+		cost += now_ns() - start;
+		if (ts < 0) {
+			skipped++;
+			continue;
+		}
+		err[n] = (ts - capture) / 1000.0;
+		sum += err[n];
+		sq += err[n] * err[n];
+		n++;
+	}
+
+	printf("device clock %.0f Hz, drift %+.1f ppm, start 0x%08x, SOF offset %u\n",
+	       freq, drift, stc0, sof_offset);
+	printf("%.0f fps for %.0f s, %u payloads per frame, latency %.0f+%.0f us, %.1f%% dropped\n",
+	       fps, seconds, payloads, latency, jitter, drop);
+	printf("  frames: %u timestamped, %u without timestamp\n", n, skipped);
+	if (n) {
+		mean = sum / n;
+		for (i = 0; i < n; i++)
+			err[i] = fabs(err[i] - mean);
+		qsort(err, n, sizeof(*err), cmp_double);
+		printf("  error:  mean %+.1f us, stddev %.1f us\n", mean, sqrt(fmax(sq / n - mean * mean, 0)));
+		printf("          |error - mean| p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		       err[n / 2], err[n * 99 / 100], err[n - 1]);
+	}
+	printf("  cost:   %.1f ns per uvc_video_clock_update\n", (double)cost / frames);
+	return 0;
+}
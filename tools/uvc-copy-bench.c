@@ -0,0 +1,603 @@
+/*
+ * Micro-benchmark of the UVC payload copy and the D4xx unpack routines
+ *
+ * uvcvideo does not convert pixel formats. uvc_video_decode_data()
+ * queues one memcpy() per payload, from behind the payload header in
+ * the URB buffer to the next free byte of the vb2 buffer, and
+ * uvc_video_copy_data_work() runs them; "copy" does the same over a
+ * whole frame split into payloads of -p bytes. With "unaligned" every
+ * payload starts with a 12-byte header, so source and destination are
+ * as misaligned as in the driver; "aligned" leaves the header out and
+ * keeps both 64-byte aligned. "unpack" is what consumers run on the
+ * dequeued buffer: YUYV to luma, Y8I and Y12I to left and right images,
+ * INZI to 8-bit IR and depth, INZC to depth and 8-bit confidence; its
+ * "unaligned" offsets input and output by one byte.
+ *
+ * Every routine has a scalar version and, on arm64, a NEON version;
+ * "copy" also runs the C library's memcpy(), which like the kernel's
+ * is hand-tuned per architecture. Build without auto-vectorisation, as
+ * below, so that "scalar" stays scalar. Each result is the best of -n
+ * runs of at least -t ms, in GB/s of frame data and, when the CPU cycle
+ * counter is available through perf_event_open(), in cycles per pixel.
+ *
+ * -o saves the results as a baseline. -b compares with a saved baseline
+ * and exits non-zero if any routine is more than -T percent slower than
+ * there; baselines only compare on the machine that saved them.
+ *
+ * Usage: uvc-copy-bench [-s WxH]... [-f fourcc]... [-p payload-size]
+ *                       [-n runs] [-t ms] [-o baseline-file]
+ *                       [-b baseline-file [-T percent]]
+ *
+ * Build: cc -O2 -fno-tree-vectorize -fno-tree-loop-distribute-patterns \
+ *           -o uvc-copy-bench uvc-copy-bench.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#define UVC_HEADER_SIZE 12
+#define ALIGN           64
+#define MAX_SIZES       16
+#define MAX_BASELINE    1024
+
+typedef void (*copy_fn)(uint8_t *dst, const uint8_t *src, size_t len);
+typedef void (*unpack_fn)(uint8_t *out0, uint8_t *out1, const uint8_t *in, size_t pixels);
+
+/* Copy */
+
+static void __attribute__((noinline)) copy_memcpy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+static void __attribute__((noinline)) copy_scalar(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, src + i, 8);
+		memcpy(dst + i, &w, 8);
+	}
+	for (; i < len; i++)
+		dst[i] = src[i];
+}
+
+/* Unpack, little-endian samples */
+
+static void __attribute__((noinline)) yuyv_scalar(uint8_t *y, uint8_t *unused,
+						  const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	(void)unused;
+	for (i = 0; i < pixels; i++)
+		y[i] = in[2 * i];
+}
+
+/* Left image in the first byte of each pixel, right in the second */
+static void __attribute__((noinline)) y8i_scalar(uint8_t *left, uint8_t *right,
+						 const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i < pixels; i++) {
+		left[i] = in[2 * i];
+		right[i] = in[2 * i + 1];
+	}
+}
+
+/*
+ * Two 12-bit samples in three bytes: right low byte, right high nibble
+ * and left low nibble, left high byte. Widened to 16 bits.
+ */
+static void __attribute__((noinline)) y12i_scalar(uint8_t *left, uint8_t *right,
+						  const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i < pixels; i++) {
+		const uint8_t *p = in + 3 * i;
+		uint16_t l = (p[2] << 4 | p[1] >> 4) << 4;
+		uint16_t r = ((p[1] & 0x0f) << 8 | p[0]) << 4;
+
+		memcpy(left + 2 * i, &l, 2);
+		memcpy(right + 2 * i, &r, 2);
+	}
+}
+
+/* A plane of 10-bit IR in 16-bit samples, then a plane of Z16 */
+static void __attribute__((noinline)) inzi_scalar(uint8_t *ir, uint8_t *depth,
+						  const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i < pixels; i++)
+		ir[i] = (in[2 * i] | in[2 * i + 1] << 8) >> 2;
+	copy_scalar(depth, in + 2 * pixels, 2 * pixels);
+}
+
+/* A plane of Z16, then 4-bit confidence, two pixels per byte, low nibble first */
+static void __attribute__((noinline)) inzc_scalar(uint8_t *depth, uint8_t *conf,
+						  const uint8_t *in, size_t pixels)
+{
+	const uint8_t *c = in + 2 * pixels;
+	size_t i;
+
+	copy_scalar(depth, in, 2 * pixels);
+	for (i = 0; i + 2 <= pixels; i += 2) {
+		conf[i] = c[i / 2] << 4;
+		conf[i + 1] = c[i / 2] & 0xf0;
+	}
+	if (i < pixels)
+		conf[i] = c[i / 2] << 4;
+}
+
+#ifdef __ARM_NEON
+static void __attribute__((noinline)) copy_neon(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		uint8x16x4_t v = vld1q_u8_x4(src + i);
+
+		vst1q_u8_x4(dst + i, v);
+	}
+	for (; i + 16 <= len; i += 16)
+		vst1q_u8(dst + i, vld1q_u8(src + i));
+	for (; i < len; i++)
+		dst[i] = src[i];
+}
+
+static void __attribute__((noinline)) yuyv_neon(uint8_t *y, uint8_t *unused,
+						const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	(void)unused;
+	for (i = 0; i + 16 <= pixels; i += 16)
+		vst1q_u8(y + i, vld2q_u8(in + 2 * i).val[0]);
+	for (; i < pixels; i++)
+		y[i] = in[2 * i];
+}
+
+static void __attribute__((noinline)) y8i_neon(uint8_t *left, uint8_t *right,
+					       const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		uint8x16x2_t v = vld2q_u8(in + 2 * i);
+
+		vst1q_u8(left + i, v.val[0]);
+		vst1q_u8(right + i, v.val[1]);
+	}
+	y8i_scalar(left + i, right + i, in + 2 * i, pixels - i);
+}
+
+static void __attribute__((noinline)) y12i_neon(uint8_t *left, uint8_t *right,
+						const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= pixels; i += 8) {
+		uint8x8x3_t v = vld3_u8(in + 3 * i);
+		uint16x8_t l = vorrq_u16(vshll_n_u8(v.val[2], 4), vmovl_u8(vshr_n_u8(v.val[1], 4)));
+		uint16x8_t r = vorrq_u16(vshll_n_u8(vand_u8(v.val[1], vdup_n_u8(0x0f)), 8),
+					 vmovl_u8(v.val[0]));
+
+		vst1q_u8(left + 2 * i, vreinterpretq_u8_u16(vshlq_n_u16(l, 4)));
+		vst1q_u8(right + 2 * i, vreinterpretq_u8_u16(vshlq_n_u16(r, 4)));
+	}
+	y12i_scalar(left + 2 * i, right + 2 * i, in + 3 * i, pixels - i);
+}
+
+static void __attribute__((noinline)) inzi_neon(uint8_t *ir, uint8_t *depth,
+						const uint8_t *in, size_t pixels)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= pixels; i += 16) {
+		uint16x8_t a = vreinterpretq_u16_u8(vld1q_u8(in + 2 * i));
+		uint16x8_t b = vreinterpretq_u16_u8(vld1q_u8(in + 2 * i + 16));
+
+		vst1q_u8(ir + i, vcombine_u8(vshrn_n_u16(a, 2), vshrn_n_u16(b, 2)));
+	}
+	for (; i < pixels; i++)
+		ir[i] = (in[2 * i] | in[2 * i + 1] << 8) >> 2;
+	copy_neon(depth, in + 2 * pixels, 2 * pixels);
+}
+
+static void __attribute__((noinline)) inzc_neon(uint8_t *depth, uint8_t *conf,
+						const uint8_t *in, size_t pixels)
+{
+	const uint8_t *c = in + 2 * pixels;
+	size_t i;
+
+	copy_neon(depth, in, 2 * pixels);
+	for (i = 0; i + 32 <= pixels; i += 32) {
+		uint8x16_t v = vld1q_u8(c + i / 2);
+		uint8x16x2_t out = { { vshlq_n_u8(v, 4), vandq_u8(v, vdupq_n_u8(0xf0)) } };
+
+		vst2q_u8(conf + i, out);
+	}
+	for (; i + 2 <= pixels; i += 2) {
+		conf[i] = c[i / 2] << 4;
+		conf[i + 1] = c[i / 2] & 0xf0;
+	}
+	if (i < pixels)
+		conf[i] = c[i / 2] << 4;
+}
+#else
+#define copy_neon       NULL
+#define yuyv_neon       NULL
+#define y8i_neon        NULL
+#define y12i_neon       NULL
+#define inzi_neon       NULL
+#define inzc_neon       NULL
+#endif
+
+/* Frame sizes are in bytes per two pixels, for INZC's 2.5 bytes per pixel */
+static const struct format {
+	const char *fourcc;
+	unsigned int in_x2;
+	unpack_fn scalar;
+	unpack_fn neon;
+} formats[] = {
+	{ "YUYV", 4, yuyv_scalar, yuyv_neon },
+	{ "Z16",  4, NULL, NULL },
+	{ "Y8I",  4, y8i_scalar, y8i_neon },
+	{ "Y12I", 6, y12i_scalar, y12i_neon },
+	{ "INZI", 8, inzi_scalar, inzi_neon },
+	{ "INZC", 5, inzc_scalar, inzc_neon },
+};
+
+#define NFORMATS (sizeof(formats) / sizeof(formats[0]))
+
+static const struct copy_routine {
+	const char *name;
+	copy_fn fn;
+} copies[] = {
+	{ "copy-memcpy", copy_memcpy },
+	{ "copy-scalar", copy_scalar },
+	{ "copy-neon", copy_neon },
+};
+
+struct job {
+	size_t pixels;
+	size_t frame;           /* bytes */
+	copy_fn copy;
+	unpack_fn unpack;
+	uint8_t *urbs;          /* payloads of the copy, each header + data */
+	size_t payload;
+	size_t data;            /* bytes of data per payload */
+	uint8_t *buf;           /* the vb2 buffer: copied to, unpacked from */
+	uint8_t *out[2];
+};
+
+struct result {
+	double gbps;
+	double cycles_px;       /* < 0 without a cycle counter */
+};
+
+struct baseline {
+	char key[96];
+	double gbps;
+};
+
+static struct baseline baseline[MAX_BASELINE];
+static unsigned int nbaseline;
+static int cycles_fd = -1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void open_cycle_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycles(void)
+{
+	uint64_t count = 0;
+
+	if (cycles_fd >= 0 && read(cycles_fd, &count, sizeof(count)) != sizeof(count))
+		count = 0;
+	return count;
+}
+
+static void *alloc(size_t size)
+{
+	void *p = aligned_alloc(ALIGN, (size + 2 * ALIGN) / ALIGN * ALIGN);
+
+	if (!p)
+		die("aligned_alloc");
+	return p;
+}
+
+/* One frame, as uvc_video_decode_data() and the copy work would */
+static void run_copy(const struct job *j)
+{
+	size_t done, n, k = 0;
+
+	for (done = 0; done < j->frame; done += n, k++) {
+		n = j->frame - done < j->data ? j->frame - done : j->data;
+		j->copy(j->buf + done, j->urbs + k * j->payload + (j->payload - j->data), n);
+	}
+}
+
+static void run_unpack(const struct job *j)
+{
+	j->unpack(j->out[0], j->out[1], j->buf, j->pixels);
+}
+
+static struct result measure(const struct job *j, void (*run)(const struct job *),
+			     unsigned int runs, unsigned int ms)
+{
+	struct result r = { 0, -1 };
+	double best = 0;
+	unsigned int i;
+
+	run(j); /* fault in and warm the caches */
+	for (i = 0; i < runs; i++) {
+		uint64_t start = now_ns(), cycles = read_cycles(), elapsed;
+		unsigned long frames = 0;
+
+		do {
+			run(j);
+			frames++;
+			elapsed = now_ns() - start;
+		} while (elapsed < ms * 1000000ull);
+		cycles = read_cycles() - cycles;
+
+		if (!best || (double)elapsed / frames < best) {
+			best = (double)elapsed / frames;
+			r.gbps = j->frame / best;
+			r.cycles_px = cycles ? (double)cycles / frames / j->pixels : -1;
+		}
+	}
+	return r;
+}
+
+static void load_baseline(const char *path)
+{
+	char line[256], fourcc[8], size[24], routine[24], align[16];
+	FILE *f = fopen(path, "r");
+	double gbps;
+
+	if (!f)
+		die(path);
+	while (fgets(line, sizeof(line), f) && nbaseline < MAX_BASELINE) {
+		if (line[0] == '#' ||
+		    sscanf(line, "%7s %23s %23s %15s %lf", fourcc, size, routine, align, &gbps) != 5)
+			continue;
+		snprintf(baseline[nbaseline].key, sizeof(baseline[0].key), "%s %s %s %s",
+			 fourcc, size, routine, align);
+		baseline[nbaseline++].gbps = gbps;
+	}
+	fclose(f);
+}
+
+static const struct baseline *find_baseline(const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < nbaseline; i++)
+		if (!strcmp(baseline[i].key, key))
+			return &baseline[i];
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s WxH]... [-f fourcc]... [-p payload-size] [-n runs] [-t ms]\n"
+		"       [-o baseline-file] [-b baseline-file [-T percent]]\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int widths[MAX_SIZES], heights[MAX_SIZES], nsizes = 0, runs = 5, ms = 50;
+	unsigned int payload = 3072, s, f, c, a, slower = 0, missing = 0;
+	const char *only[NFORMATS], *save = NULL, *compare = NULL;
+	unsigned int nonly = 0;
+	double threshold = 10;
+	struct utsname uts;
+	FILE *out = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:f:p:n:t:o:b:T:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (nsizes == MAX_SIZES ||
+			    sscanf(optarg, "%ux%u", &widths[nsizes], &heights[nsizes]) != 2 ||
+			    !widths[nsizes] || !heights[nsizes])
+				usage(argv[0]);
+			nsizes++;
+			break;
+		case 'f':
+			if (nonly == NFORMATS)
+				usage(argv[0]);
+			only[nonly++] = optarg;
+			break;
+		case 'p': payload = strtoul(optarg, NULL, 0); break;
+		case 'n': runs = strtoul(optarg, NULL, 0); break;
+		case 't': ms = strtoul(optarg, NULL, 0); break;
+		case 'o': save = optarg; break;
+		case 'b': compare = optarg; break;
+		case 'T': threshold = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || payload < ALIGN || !runs || !ms)
+		usage(argv[0]);
+	if (!nsizes) {
+		/* The D4xx depth and infrared sizes used on the robots */
+		widths[0] = 640, heights[0] = 480;
+		widths[1] = 1280, heights[1] = 720;
+		nsizes = 2;
+	}
+	for (f = 0; f < nonly; f++) {
+		for (c = 0; c < NFORMATS; c++)
+			if (!strcmp(only[f], formats[c].fourcc))
+				break;
+		if (c == NFORMATS) {
+			fprintf(stderr, "%s: unknown format %s\n", argv[0], only[f]);
+			return 2;
+		}
+	}
+
+	if (compare)
+		load_baseline(compare);
+	uname(&uts);
+	if (save) {
+		out = fopen(save, "w");
+		if (!out)
+			die(save);
+		fprintf(out, "# uvc-copy-bench baseline, %s %s, payload %u bytes\n",
+			uts.machine, uts.nodename, payload);
+	}
+	open_cycle_counter();
+
+	printf("%s, payload %u bytes, best of %u runs of %u ms%s\n", uts.machine, payload, runs, ms,
+	       cycles_fd < 0 ? ", no cycle counter" : "");
+	printf("%-5s %-10s %-14s %-10s %8s %8s%s\n", "fmt", "size", "routine", "align", "GB/s",
+	       "cyc/px", compare ? "  baseline  change" : "");
+
+	for (s = 0; s < nsizes; s++) {
+		for (f = 0; f < NFORMATS; f++) {
+			const struct format *fmt = &formats[f];
+			size_t pixels = (size_t)widths[s] * heights[s];
+			size_t frame = pixels * fmt->in_x2 / 2;
+			size_t data = payload - UVC_HEADER_SIZE;
+			size_t npayloads = (frame + data - 1) / data + 1;
+			uint8_t *urbs, *in, *out0, *out1;
+			char sizestr[24];
+
+			for (c = 0; c < nonly; c++)
+				if (!strcmp(only[c], fmt->fourcc))
+					break;
+			if (nonly && c == nonly)
+				continue;
+			snprintf(sizestr, sizeof(sizestr), "%ux%u", widths[s], heights[s]);
+
+			urbs = alloc(npayloads * payload);
+			in = alloc(frame + 1);
+			out0 = alloc(pixels * 2 + 1);
+			out1 = alloc(pixels * 2 + 1);
+			for (c = 0; c < npayloads * payload; c++)
+				urbs[c] = rand();
+			memcpy(in, urbs, frame + 1);
+			memset(out0, 0, pixels * 2 + 1);
+			memset(out1, 0, pixels * 2 + 1);
+
+			for (a = 0; a < 2; a++) {
+				struct job j = { .pixels = pixels, .frame = frame, .urbs = urbs };
+				unsigned int r;
+
+				for (r = 0; r < 5; r++) {
+					const char *name;
+					void (*run)(const struct job *);
+					const struct baseline *b;
+					struct result res;
+					char key[96];
+
+					if (r < 3) {
+						/*
+						 * Payloads in the driver start behind their header;
+						 * aligned ones leave it out and keep 64-byte sizes
+						 */
+						j.copy = copies[r].fn;
+						j.payload = a ? payload : payload / ALIGN * ALIGN;
+						j.data = a ? data : j.payload;
+						j.buf = in;
+						name = copies[r].name;
+						run = run_copy;
+					} else {
+						j.unpack = r == 3 ? fmt->scalar : fmt->neon;
+						j.buf = in + a;
+						j.out[0] = out0 + a;
+						j.out[1] = out1 + a;
+						name = r == 3 ? "unpack-scalar" : "unpack-neon";
+						run = run_unpack;
+					}
+					if ((r < 3 && !j.copy) || (r >= 3 && !j.unpack))
+						continue;
+
+					res = measure(&j, run, runs, ms);
+					snprintf(key, sizeof(key), "%s %s %s %s", fmt->fourcc, sizestr, name,
+						 a ? "unaligned" : "aligned");
+					printf("%-5s %-10s %-14s %-10s %8.2f ", fmt->fourcc, sizestr, name,
+					       a ? "unaligned" : "aligned", res.gbps);
+					if (res.cycles_px >= 0)
+						printf("%8.3f", res.cycles_px);
+					else
+						printf("%8s", "-");
+					if (compare) {
+						b = find_baseline(key);
+						if (!b) {
+							printf("  %8s", "-");
+							missing++;
+						} else {
+							double change = 100.0 * (res.gbps - b->gbps) / b->gbps;
+
+							printf("  %8.2f  %+5.1f%%", b->gbps, change);
+							if (change < -threshold) {
+								printf("  SLOWER");
+								slower++;
+							}
+						}
+					}
+					printf("\n");
+					if (out)
+						fprintf(out, "%s %.3f\n", key, res.gbps);
+				}
+			}
+			free(urbs);
+			free(in);
+			free(out0);
+			free(out1);
+		}
+	}
+
+	if (out && fclose(out))
+		die(save);
+	if (compare) {
+		if (missing)
+			printf("%u result(s) not in %s\n", missing, compare);
+		printf("%u routine(s) more than %.0f%% slower than %s\n", slower, threshold, compare);
+	}
+	return slower ? 1 : 0;
+}
@@ -0,0 +1,583 @@
+/*
+ * Replay usbmon captures of UVC streams through the payload decoder
+ *
+ * Reads a pcap file captured on a usbmon interface ("tcpdump -i usbmonN
+ * -w capture.pcap", or Wireshark saved as pcap), takes the URBs of one
+ * video streaming endpoint and feeds them through a userspace copy of
+ * uvcvideo's payload handling: uvc_video_decode_start, _data, _end and
+ * _meta behind the isochronous and bulk URB framing of
+ * uvc_video_decode_isoc and uvc_video_decode_bulk, as of Linux 5.15.
+ * The driver sources are not part of this repository, so the decoder is
+ * a transcription rather than the driver's object code; keep it in step
+ * with the uvc_video.c the modules are built from. Data is copied
+ * inline where the driver defers the copy to uvc_video_copy_data_work.
+ *
+ * Reports complete and erroneous frames, dropped and invalid payloads
+ * and the decode cost per payload, taking the fastest of several passes.
+ * The frame size and the bulk payload size come from the last SET_CUR
+ * of VS_COMMIT_CONTROL before the stream, unless given.
+ *
+ * Usage: uvc-replay [-e endpoint] [-d bus:device] [-s frame-size]
+ *                   [-p max-payload] [-m d4xx|uvc] [-n passes] capture.pcap
+ *
+ * Build: cc -O2 -o uvc-replay uvc-replay.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UVC_STREAM_EOH  (1 << 7)
+#define UVC_STREAM_ERR  (1 << 6)
+#define UVC_STREAM_SCR  (1 << 3)
+#define UVC_STREAM_PTS  (1 << 2)
+#define UVC_STREAM_EOF  (1 << 1)
+#define UVC_STREAM_FID  (1 << 0)
+
+#define UVC_METADATA_BUF_SIZE 10240
+
+/* pcap link types of usbmon captures */
+#define LINKTYPE_USB_LINUX              189
+#define LINKTYPE_USB_LINUX_MMAPPED      220
+
+#define XFER_ISO        0
+#define XFER_CONTROL    2
+#define XFER_BULK       3
+
+struct usbmon_hdr {
+	uint64_t id;
+	uint8_t type;           /* 'S'ubmit, 'C'omplete, 'E'rror */
+	uint8_t xfer_type;
+	uint8_t epnum;
+	uint8_t devnum;
+	uint16_t busnum;
+	int8_t flag_setup;
+	int8_t flag_data;
+	int64_t ts_sec;
+	int32_t ts_usec;
+	int32_t status;
+	uint32_t urb_len;
+	uint32_t data_len;
+	uint8_t setup[8];
+	/* LINKTYPE_USB_LINUX_MMAPPED only */
+	int32_t interval;
+	int32_t start_frame;
+	uint32_t xfer_flags;
+	uint32_t ndesc;
+} __attribute__((packed));
+
+struct iso_desc {
+	int32_t status;
+	uint32_t offset;
+	uint32_t len;
+	uint32_t pad;
+} __attribute__((packed));
+
+/* A completed URB of the replayed endpoint */
+struct urb {
+	const uint8_t *data;
+	uint32_t actual;
+	uint32_t length;        /* transfer_buffer_length, from the submission */
+	const struct iso_desc *desc;
+	uint32_t ndesc;
+};
+
+struct buffer {
+	uint8_t *mem;
+	uint32_t length;
+	uint32_t bytesused;
+	int active;
+	int ready;
+	int error;
+};
+
+struct stats {
+	unsigned long frames;
+	unsigned long error_frames;
+	unsigned long wrong_size;
+	unsigned long payloads;
+	unsigned long invalid;
+	unsigned long out_of_sync;
+	unsigned long lost;
+	unsigned long meta_blocks;
+	unsigned long long bytes;
+};
+
+struct stream {
+	uint32_t frame_size;
+	uint32_t max_payload;
+	int meta_uvc;           /* V4L2_META_FMT_UVC instead of the D4xx format */
+	int last_fid;
+	uint8_t last_scr[6];
+	struct {
+		uint8_t header[256];
+		uint32_t header_size;
+		int skip_payload;
+		uint32_t payload_size;
+	} bulk;
+	struct buffer buf, meta;
+	struct stats stats;
+};
+
+/* uvc_video_next_buffers(), with an endless supply of buffers */
+static void next_buffers(struct stream *s)
+{
+	struct buffer *buf = &s->buf;
+
+	/* uvc_video_validate_buffer() */
+	if (buf->bytesused != s->frame_size) {
+		buf->error = 1;
+		s->stats.wrong_size++;
+	}
+	if (buf->error)
+		s->stats.error_frames++;
+	else
+		s->stats.frames++;
+	buf->bytesused = 0;
+	buf->active = buf->ready = buf->error = 0;
+	s->meta.bytesused = 0;
+}
+
+static int decode_start(struct stream *s, const uint8_t *data, int len)
+{
+	struct buffer *buf = &s->buf;
+	int fid;
+
+	/*
+	 * Sanity checks:
+	 * - packet must be at least 2 bytes long
+	 * - bHeaderLength value must be at least 2 bytes
+	 * - bHeaderLength value can't be larger than the packet size.
+	 */
+	if (len < 2 || data[0] < 2 || data[0] > len) {
+		s->stats.invalid++;
+		return -EINVAL;
+	}
+	fid = data[1] & UVC_STREAM_FID;
+
+	if (data[1] & UVC_STREAM_ERR)
+		buf->error = 1;
+
+	/* Synchronize to the input stream by waiting for the FID bit to be
+	 * toggled when the buffer state is not ACTIVE */
+	if (!buf->active) {
+		if (fid == s->last_fid) {
+			s->stats.out_of_sync++;
+			return -ENODATA;
+		}
+		buf->active = 1;
+	}
+
+	/* Mark the buffer as done if we're at the beginning of a new frame */
+	if (fid != s->last_fid && buf->bytesused != 0) {
+		buf->ready = 1;
+		return -EAGAIN;
+	}
+
+	s->last_fid = fid;
+	return data[0];
+}
+
+static void decode_data(struct stream *s, const uint8_t *data, int len)
+{
+	struct buffer *buf = &s->buf;
+	uint32_t maxlen;
+
+	if (len <= 0)
+		return;
+
+	maxlen = buf->length - buf->bytesused;
+	memcpy(buf->mem + buf->bytesused, data, (uint32_t)len < maxlen ? (uint32_t)len : maxlen);
+	buf->bytesused += (uint32_t)len < maxlen ? (uint32_t)len : maxlen;
+	s->stats.bytes += len;
+
+	/* Complete the current frame if the buffer size was exceeded */
+	if ((uint32_t)len > maxlen) {
+		buf->error = 1;
+		buf->ready = 1;
+	}
+}
+
+static void decode_end(struct stream *s, const uint8_t *data)
+{
+	/* Mark the buffer as done if the EOF marker is set */
+	if (data[1] & UVC_STREAM_EOF && s->buf.bytesused != 0)
+		s->buf.ready = 1;
+}
+
+static void decode_meta(struct stream *s, const uint8_t *mem, int length)
+{
+	struct buffer *meta = &s->meta;
+	const uint8_t *scr;
+	int len_std = 2, has_pts, has_scr;
+	uint64_t ns;
+	uint16_t sof;
+
+	if (length == 2)
+		return;
+	if (meta->length - meta->bytesused < length + sizeof(ns) + sizeof(sof)) {
+		meta->error = 1;
+		return;
+	}
+
+	has_pts = mem[1] & UVC_STREAM_PTS;
+	has_scr = mem[1] & UVC_STREAM_SCR;
+	if (has_pts) {
+		len_std += 4;
+		scr = mem + 6;
+	} else {
+		scr = mem + 2;
+	}
+	if (has_scr)
+		len_std += 6;
+	if (s->meta_uvc)
+		length = len_std;
+
+	/* Drop SCRs with an SOF identical to the previous one */
+	if (length == len_std && (!has_scr || !memcmp(scr, s->last_scr, 6)))
+		return;
+
+	ns = s->stats.payloads;
+	sof = s->stats.payloads & 0x7ff;
+	memcpy(meta->mem + meta->bytesused, &ns, sizeof(ns));
+	memcpy(meta->mem + meta->bytesused + sizeof(ns), &sof, sizeof(sof));
+	if (has_scr)
+		memcpy(s->last_scr, scr, 6);
+	memcpy(meta->mem + meta->bytesused + sizeof(ns) + sizeof(sof), mem, length);
+	meta->bytesused += length + sizeof(ns) + sizeof(sof);
+	s->stats.meta_blocks++;
+}
+
+static void decode_isoc(struct stream *s, const struct urb *urb)
+{
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < urb->ndesc; i++) {
+		const struct iso_desc *d = &urb->desc[i];
+		const uint8_t *mem = urb->data + d->offset;
+
+		if (d->status < 0 || d->offset + d->len > urb->actual) {
+			s->stats.lost++;
+			s->buf.error = 1;
+			continue;
+		}
+		s->stats.payloads++;
+
+		/* Decode the payload header */
+		do {
+			ret = decode_start(s, mem, d->len);
+			if (ret == -EAGAIN)
+				next_buffers(s);
+		} while (ret == -EAGAIN);
+		if (ret < 0)
+			continue;
+
+		decode_meta(s, mem, ret);
+		decode_data(s, mem + ret, d->len - ret);
+		decode_end(s, mem);
+		if (s->buf.ready)
+			next_buffers(s);
+	}
+}
+
+static void decode_bulk(struct stream *s, const struct urb *urb)
+{
+	const uint8_t *mem = urb->data;
+	int len = urb->actual, ret;
+
+	if (urb->actual == 0 && s->bulk.header_size == 0)
+		return;
+	s->bulk.payload_size += len;
+
+	/* If the URB is the first of its payload, decode and save the header */
+	if (s->bulk.header_size == 0 && !s->bulk.skip_payload) {
+		s->stats.payloads++;
+		do {
+			ret = decode_start(s, mem, len);
+			if (ret == -EAGAIN)
+				next_buffers(s);
+		} while (ret == -EAGAIN);
+
+		/* If an error occurred skip the rest of the payload */
+		if (ret < 0) {
+			s->bulk.skip_payload = 1;
+		} else {
+			memcpy(s->bulk.header, mem, ret);
+			s->bulk.header_size = ret;
+			decode_meta(s, mem, ret);
+			mem += ret;
+			len -= ret;
+		}
+	}
+
+	if (!s->bulk.skip_payload)
+		decode_data(s, mem, len);
+
+	/* Detect the payload end by a URB smaller than the maximum size (or
+	 * a payload size equal to the maximum) and process the header again */
+	if (urb->actual < urb->length || s->bulk.payload_size >= s->max_payload) {
+		if (!s->bulk.skip_payload) {
+			decode_end(s, s->bulk.header);
+			if (s->buf.ready)
+				next_buffers(s);
+		}
+		s->bulk.header_size = 0;
+		s->bulk.skip_payload = 0;
+		s->bulk.payload_size = 0;
+	}
+}
+
+static void reset(struct stream *s)
+{
+	memset(&s->stats, 0, sizeof(s->stats));
+	memset(&s->bulk, 0, sizeof(s->bulk));
+	memset(s->last_scr, 0, sizeof(s->last_scr));
+	s->last_fid = -1;
+	s->buf.bytesused = s->meta.bytesused = 0;
+	s->buf.active = s->buf.ready = s->buf.error = 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-e endpoint] [-d bus:device] [-s frame-size] "
+		"[-p max-payload] [-m d4xx|uvc] [-n passes] capture.pcap\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int want_ep = 0, want_bus = 0, want_dev = 0, passes = 5;
+	uint32_t frame_size = 0, max_payload = 0, commit_frame = 0, commit_payload = 0;
+	const uint8_t *file, *p, *end;
+	struct stream s = { 0 };
+	struct urb *urbs = NULL;
+	size_t nurbs = 0, cap = 0, hdr_len, i;
+	struct { uint64_t id; uint32_t len; } submitted[64] = { { 0 } };
+	unsigned int nsub = 0, truncated = 0, pass, xfer = XFER_ISO;
+	uint64_t best = UINT64_MAX;
+	struct stat st;
+	int fd, opt, linktype;
+
+	while ((opt = getopt(argc, argv, "e:d:s:p:m:n:")) != -1) {
+		switch (opt) {
+		case 'e': want_ep = strtoul(optarg, NULL, 0); break;
+		case 'd':
+			if (sscanf(optarg, "%u:%u", &want_bus, &want_dev) != 2)
+				usage(argv[0]);
+			break;
+		case 's': frame_size = strtoul(optarg, NULL, 0); break;
+		case 'p': max_payload = strtoul(optarg, NULL, 0); break;
+		case 'm': s.meta_uvc = !strcmp(optarg, "uvc"); break;
+		case 'n': passes = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || passes == 0)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	file = st.st_size >= 24 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	if (file == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	end = file + st.st_size;
+
+	if (!file || (*(uint32_t *)file != 0xa1b2c3d4 && *(uint32_t *)file != 0xa1b23c4d)) {
+		fprintf(stderr, "%s: not a little-endian pcap file (pcapng needs converting "
+			"with editcap -F pcap)\n", argv[optind]);
+		return 1;
+	}
+	linktype = *(uint32_t *)(file + 20);
+	if (linktype == LINKTYPE_USB_LINUX_MMAPPED) {
+		hdr_len = sizeof(struct usbmon_hdr);
+	} else if (linktype == LINKTYPE_USB_LINUX) {
+		hdr_len = 48;
+	} else {
+		fprintf(stderr, "%s: link type %d is not usbmon\n", argv[optind], linktype);
+		return 1;
+	}
+
+	/* Without an endpoint, replay the IN endpoint that moved most data */
+	if (!want_ep) {
+		struct { unsigned int bus, dev, ep; unsigned long long bytes; } eps[32];
+		unsigned int neps = 0, j, k;
+
+		for (p = file + 24; p + 16 <= end; p += 16 + *(uint32_t *)(p + 8)) {
+			const struct usbmon_hdr *h = (const void *)(p + 16);
+			uint32_t caplen = *(uint32_t *)(p + 8);
+
+			/* A capture cut short ends with a partial record */
+			if (caplen > (size_t)(end - p - 16))
+				break;
+			if (caplen < hdr_len || h->type != 'C' || !(h->epnum & 0x80) ||
+			    (h->xfer_type != XFER_ISO && h->xfer_type != XFER_BULK))
+				continue;
+			for (j = 0; j < neps; j++)
+				if (eps[j].bus == h->busnum && eps[j].dev == h->devnum && eps[j].ep == h->epnum)
+					break;
+			if (j == neps && neps < 32)
+				eps[neps++] = (typeof(eps[0])){ h->busnum, h->devnum, h->epnum, 0 };
+			if (j < neps)
+				eps[j].bytes += h->data_len;
+		}
+		for (j = k = 0; j < neps; j++)
+			if (eps[j].bytes > eps[k].bytes)
+				k = j;
+		if (!neps) {
+			fprintf(stderr, "%s: no isochronous or bulk IN transfers\n", argv[optind]);
+			return 1;
+		}
+		want_bus = eps[k].bus;
+		want_dev = eps[k].dev;
+		want_ep = eps[k].ep;
+	}
+
+	for (p = file + 24; p + 16 <= end; p += 16 + *(uint32_t *)(p + 8)) {
+		const struct usbmon_hdr *h = (const void *)(p + 16);
+		uint32_t caplen = *(uint32_t *)(p + 8);
+		const uint8_t *data = p + 16 + hdr_len;
+		struct urb u = { 0 };
+
+		if (caplen > (size_t)(end - p - 16) || caplen < hdr_len)
+			break;
+		if ((want_bus && h->busnum != want_bus) || (want_dev && h->devnum != want_dev))
+			continue;
+
+		/* Stream parameters from SET_CUR(VS_COMMIT_CONTROL) */
+		if (h->type == 'S' && h->xfer_type == XFER_CONTROL && h->flag_setup == 0 &&
+		    h->setup[0] == 0x21 && h->setup[1] == 0x01 && h->setup[3] == 0x02 &&
+		    caplen - hdr_len >= 26 && !nurbs) {
+			memcpy(&commit_frame, data + 18, 4);
+			memcpy(&commit_payload, data + 22, 4);
+			continue;
+		}
+		if (h->epnum != want_ep)
+			continue;
+
+		if (h->type == 'S') {
+			submitted[nsub % 64].id = h->id;
+			submitted[nsub % 64].len = h->urb_len;
+			nsub++;
+			continue;
+		}
+		if (h->type != 'C' || (h->status != 0 && h->status != -EXDEV))
+			continue;
+
+		xfer = h->xfer_type;
+		u.data = data;
+		u.actual = caplen - hdr_len;
+		if (xfer == XFER_ISO) {
+			if (linktype != LINKTYPE_USB_LINUX_MMAPPED) {
+				fprintf(stderr, "%s: isochronous replay needs a LINKTYPE_USB_LINUX_MMAPPED "
+					"capture\n", argv[optind]);
+				return 1;
+			}
+			u.desc = (const void *)data;
+			u.ndesc = h->ndesc;
+			if (u.ndesc * sizeof(struct iso_desc) > u.actual) {
+				truncated++;
+				continue;
+			}
+			u.data += u.ndesc * sizeof(struct iso_desc);
+			u.actual -= u.ndesc * sizeof(struct iso_desc);
+		} else {
+			if (u.actual < h->urb_len) {
+				truncated++;
+				continue;
+			}
+			u.length = u.actual + 1;
+			for (i = 0; i < 64 && i < nsub; i++)
+				if (submitted[i].id == h->id)
+					u.length = submitted[i].len;
+		}
+
+		if (nurbs == cap) {
+			cap = cap ? cap * 2 : 4096;
+			urbs = realloc(urbs, cap * sizeof(*urbs));
+			if (!urbs) {
+				perror("realloc");
+				return 1;
+			}
+		}
+		urbs[nurbs++] = u;
+	}
+
+	if (!nurbs) {
+		fprintf(stderr, "%s: no completed URBs on endpoint 0x%02x\n", argv[optind], want_ep);
+		return 1;
+	}
+	if (!frame_size)
+		frame_size = commit_frame;
+	if (!max_payload)
+		max_payload = commit_payload;
+	if (!frame_size || (xfer == XFER_BULK && !max_payload)) {
+		fprintf(stderr, "%s: no VS_COMMIT_CONTROL in the capture; give -s%s\n",
+			argv[optind], xfer == XFER_BULK ? " and -p" : "");
+		return 1;
+	}
+
+	s.frame_size = frame_size;
+	s.max_payload = max_payload;
+	s.buf.length = frame_size;
+	s.buf.mem = malloc(frame_size);
+	s.meta.length = UVC_METADATA_BUF_SIZE;
+	s.meta.mem = malloc(UVC_METADATA_BUF_SIZE);
+	if (!s.buf.mem || !s.meta.mem) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (pass = 0; pass < passes; pass++) {
+		uint64_t start;
+
+		reset(&s);
+		start = now_ns();
+		for (i = 0; i < nurbs; i++) {
+			if (xfer == XFER_ISO)
+				decode_isoc(&s, &urbs[i]);
+			else
+				decode_bulk(&s, &urbs[i]);
+		}
+		if (now_ns() - start < best)
+			best = now_ns() - start;
+	}
+
+	printf("%s: bus %u device %u endpoint 0x%02x, %s, %zu URBs\n", argv[optind],
+	       want_bus, want_dev, want_ep, xfer == XFER_ISO ? "isochronous" : "bulk", nurbs);
+	printf("  frame size %u bytes", frame_size);
+	if (xfer == XFER_BULK)
+		printf(", max payload %u bytes", max_payload);
+	printf("%s\n", commit_frame && frame_size == commit_frame ? " (from VS_COMMIT_CONTROL)" : "");
+	if (truncated)
+		printf("  %u URBs skipped: truncated by the capture's snap length\n", truncated);
+	printf("  frames:   %lu complete, %lu with errors (%lu of wrong size)\n",
+	       s.stats.frames, s.stats.error_frames, s.stats.wrong_size);
+	printf("  payloads: %lu, %lu invalid, %lu out of sync, %lu lost packets\n",
+	       s.stats.payloads, s.stats.invalid, s.stats.out_of_sync, s.stats.lost);
+	printf("  metadata: %lu blocks (%s format)\n", s.stats.meta_blocks, s.meta_uvc ? "UVC" : "D4XX");
+	printf("  decode:   %.1f ns per payload, %.0f MB/s (best of %u passes)\n",
+	       s.stats.payloads ? (double)best / s.stats.payloads : 0.0,
+	       best ? s.stats.bytes * 1000.0 / best : 0.0, passes);
+	return 0;
+}